@@ -0,0 +1,519 @@
+// Microbenchmarks for the VEB variants, the ID index backends and Arbor operations.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o arbor_bench bench.cpp && ./arbor_bench
+//
+// Options:
+//   --quick          smaller sweeps (smoke test)
+//   --reps N         measured repetitions per case (default 15)
+//   --warmup N       unmeasured repetitions per case (default 3)
+//   --filter TEXT    only run cases whose name contains TEXT (e.g. index/ for the
+//                    ID index backend comparison)
+//   --json FILE      also write all results as JSON (for regression tracking)
+//
+// Each case runs a fixed batch of operations per repetition; the report gives
+// per-operation latency percentiles across repetitions and the throughput at
+// the median.
+
+#define ARBOR_NO_MAIN
+#include "main.cpp"
+
+// ------------------------------ Harness --------------------------------------
+struct Bench_Config {
+    int warmup = 3;
+    int reps = 15;
+    bool quick = false;
+    string filter;
+    string json_path;
+};
+
+struct Bench_Result {
+    string name;
+    vector<pair<string,long long>> params;
+    size_t ops = 0;              // operations per repetition
+    vector<double> ns_per_op;    // one sample per repetition, sorted
+
+    double pct(double p) const {
+        if (ns_per_op.empty()) return 0;
+        size_t i = (size_t)ceil(p / 100.0 * ns_per_op.size());
+        return ns_per_op[min(ns_per_op.size() - 1, i ? i - 1 : 0)];
+    }
+};
+
+static volatile long long g_sink;   // keeps measured work observable
+
+class Bench_Runner {
+public:
+    explicit Bench_Runner(const Bench_Config& c): cfg(c) {}
+
+    bool wanted(const string& name) const {
+        return cfg.filter.empty() || name.find(cfg.filter) != string::npos;
+    }
+
+    // fn() performs `ops` operations and returns a checksum.
+    template <class Fn>
+    void run(const string& name, vector<pair<string,long long>> params, size_t ops, Fn&& fn) {
+        if (!wanted(name) || !ops) return;
+        Bench_Result r{name, std::move(params), ops, {}};
+        for (int i = 0; i < cfg.warmup; ++i) g_sink = g_sink + fn();
+        for (int i = 0; i < cfg.reps; ++i) {
+            auto t0 = steady_clock::now();
+            long long sum = fn();
+            auto t1 = steady_clock::now();
+            g_sink = g_sink + sum;
+            r.ns_per_op.push_back(duration<double, nano>(t1 - t0).count() / (double)ops);
+        }
+        sort(r.ns_per_op.begin(), r.ns_per_op.end());
+        print(r);
+        results.push_back(std::move(r));
+    }
+
+    void write_json(const string& path) const {
+        ofstream out(path);
+        if (!out) { cerr << "[bench] cannot open: " << path << "\n"; return; }
+        out << "{\n  \"warmup\": " << cfg.warmup << ",\n  \"reps\": " << cfg.reps << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Bench_Result& r = results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"params\": {";
+            for (size_t k = 0; k < r.params.size(); ++k) {
+                out << (k ? ", " : "") << "\"" << r.params[k].first << "\": " << r.params[k].second;
+            }
+            out << "}, \"ops_per_rep\": " << r.ops
+                << ", \"ns_per_op\": {\"min\": " << r.ns_per_op.front() << ", \"p50\": " << r.pct(50)
+                << ", \"p90\": " << r.pct(90) << ", \"p99\": " << r.pct(99) << ", \"max\": " << r.ns_per_op.back()
+                << "}, \"ops_per_sec\": " << 1e9 / r.pct(50) << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        cerr << "[bench] wrote " << path << "\n";
+    }
+
+private:
+    Bench_Config cfg;
+    vector<Bench_Result> results;
+
+    static void print(const Bench_Result& r) {
+        string label = r.name;
+        for (auto& kv : r.params) label += " " + kv.first + "=" + to_string(kv.second);
+        printf("%-52s p50 %10.1f ns  p90 %10.1f ns  p99 %10.1f ns  %12.0f ops/s\n",
+               label.c_str(), r.pct(50), r.pct(90), r.pct(99), 1e9 / r.pct(50));
+        fflush(stdout);
+    }
+};
+
+// Random keys / pairs are generated once per case, outside the timed region.
+static vector<int> random_keys(size_t n, int universe, uint32_t seed) {
+    mt19937 rng(seed);
+    vector<int> v(n);
+    for (auto& x : v) x = (int)(rng() % (uint32_t)universe);
+    return v;
+}
+
+// Discards everything written to it (for export benchmarks).
+struct Null_Buffer : streambuf {
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+// ------------------------------ VEB cases ------------------------------------
+template <class Veb, class Make>
+static void bench_veb(Bench_Runner& R, const string& kind, int U, size_t ops, Make make) {
+    vector<int> keys = random_keys(ops, U, 1), probes = random_keys(ops, U, 2);
+    R.run("veb_insert/" + kind, {{"U", U}}, ops, [&] {
+        auto v = make(U);
+        for (int k : keys) v->insert(k);
+        return (long long)v->max();
+    });
+    auto filled = make(U);
+    for (int k : keys) filled->insert(k);
+    R.run("veb_contains/" + kind, {{"U", U}}, ops, [&] {
+        long long hits = 0;
+        for (int k : probes) hits += filled->contains(k);
+        return hits;
+    });
+    R.run("veb_successor/" + kind, {{"U", U}}, ops, [&] {
+        long long sum = 0;
+        for (int k : probes) sum += filled->successor(k);
+        return sum;
+    });
+    // Full scans: successor() chain vs the allocation-free visitor vs the
+    // cluster-parallel visitor (ops = keys in the tree).
+    vector<int> all;
+    filled->enumerate(all);
+    R.run("veb_scan/" + kind + "/successor", {{"U", U}}, all.size(), [&] {
+        long long sum = 0;
+        for (int k = filled->min(); k != -1; k = filled->successor(k)) sum += k;
+        return sum;
+    });
+    R.run("veb_scan/" + kind + "/visitor", {{"U", U}}, all.size(), [&] {
+        long long sum = 0;
+        filled->for_each_in_range(0, U, [&](int k) { sum += k; });
+        return sum;
+    });
+    R.run("veb_scan/" + kind + "/parallel", {{"U", U}}, all.size(), [&] {
+        vector<long long> part(max(1u, std::thread::hardware_concurrency()), 0);
+        filled->parallel_for_each_in_range(0, U, 0, [&](int k, int tid) { part[tid] += k; });
+        return accumulate(part.begin(), part.end(), 0LL);
+    });
+    // Consecutive IDs, as Arbor assigns them: one insert() each vs one insert_sorted().
+    vector<int> ids(ops);
+    iota(ids.begin(), ids.end(), 0);
+    R.run("veb_fill/" + kind + "/insert", {{"U", U}}, ops, [&] {
+        auto v = make(U);
+        for (int k : ids) v->insert(k);
+        return (long long)v->max();
+    });
+    R.run("veb_fill/" + kind + "/sorted", {{"U", U}}, ops, [&] {
+        auto v = make(U);
+        v->insert_sorted(ids.data(), ids.size());
+        return (long long)v->max();
+    });
+}
+
+static void bench_vebs(Bench_Runner& R, const Bench_Config& cfg) {
+    vector<int> universes = cfg.quick ? vector<int>{1 << 10, 1 << 16} : vector<int>{1 << 10, 1 << 16, 1 << 20, 1 << 24};
+    for (int U : universes) {
+        size_t ops = (size_t)min(U / 4, cfg.quick ? 1 << 14 : 1 << 18);
+        bench_veb<Van_Emde_Boas>(R, "sqrt_lazy", U, ops, [](int u) { return make_unique<Van_Emde_Boas>(u, true); });
+        if (U <= (1 << 16)) {   // eager sqrt allocation is the bottleneck beyond this
+            bench_veb<Van_Emde_Boas>(R, "sqrt_eager", U, ops, [](int u) { return make_unique<Van_Emde_Boas>(u); });
+        }
+        bench_veb<Van_Emde_Boas_Pow2>(R, "pow2_lazy", U, ops, [](int u) { return make_unique<Van_Emde_Boas_Pow2>(u, true); });
+        bench_veb<Flat_Van_Emde_Boas>(R, "flat", U, ops, [](int u) { return make_unique<Flat_Van_Emde_Boas>(u); });
+        // Compile-time universes (heap-allocated only because 2^16+ is large for the stack).
+        if (U == 1 << 10) bench_veb<Static_Van_Emde_Boas<10>>(R, "static", U, ops, [](int) { return make_unique<Static_Van_Emde_Boas<10>>(); });
+        if (U == 1 << 16) bench_veb<Static_Van_Emde_Boas<16>>(R, "static", U, ops, [](int) { return make_unique<Static_Van_Emde_Boas<16>>(); });
+        if (U == 1 << 20) bench_veb<Static_Van_Emde_Boas<20>>(R, "static", U, ops, [](int) { return make_unique<Static_Van_Emde_Boas<20>>(); });
+    }
+}
+
+// ------------------------------ ID index cases -------------------------------
+// Key distributions: dense = the first n IDs (what Arbor produces), sparse =
+// uniform over a universe 64x larger, clustered = runs of 256 consecutive IDs
+// at random offsets.
+static vector<int> index_keys(const string& dist, size_t n, int U, uint32_t seed) {
+    if (dist == "dense") {
+        vector<int> v(n);
+        iota(v.begin(), v.end(), 0);
+        shuffle(v.begin(), v.end(), mt19937(seed));
+        return v;
+    }
+    if (dist == "sparse") return random_keys(n, U, seed);
+    mt19937 rng(seed);
+    vector<int> v;
+    v.reserve(n);
+    while (v.size() < n) {
+        int base = (int)(rng() % (uint32_t)(U - 256));
+        for (int i = 0; i < 256 && v.size() < n; ++i) v.push_back(base + i);
+    }
+    return v;
+}
+
+static void bench_indexes(Bench_Runner& R, const Bench_Config& cfg) {
+    size_t n = cfg.quick ? 1 << 13 : 1 << 18;
+    for (string dist : {"dense", "sparse", "clustered"}) {
+        int U = dist == "dense" ? (int)n : (int)n * 64;
+        vector<int> keys = index_keys(dist, n, U, 11), probes = random_keys(n, U, 12);
+        for (auto& kv : INDEX_KINDS) {
+            Index_Kind kind = kv.second;
+            // Out-of-order inserts are O(n) each for the sorted vector.
+            size_t ins_ops = kind == Index_Kind::SORTED_VECTOR ? min<size_t>(n, 1 << 13) : n;
+            string base = string("index/") + kv.first + "/" + dist;
+            vector<pair<string,long long>> params = {{"U", U}, {"n", (long long)n}};
+            R.run(base + "/insert", params, ins_ops, [&] {
+                auto ix = make_id_index(kind, U, true);
+                for (size_t i = 0; i < ins_ops; ++i) ix->insert(keys[i]);
+                return (long long)ix->max();
+            });
+            auto filled = make_id_index(kind, U, true);
+            if (kind == Index_Kind::SORTED_VECTOR) {
+                vector<int> sorted = keys;
+                sort(sorted.begin(), sorted.end());
+                for (int k : sorted) filled->insert(k);
+            } else {
+                for (int k : keys) filled->insert(k);
+            }
+            R.run(base + "/contains", params, n, [&] {
+                long long hits = 0;
+                for (int k : probes) hits += filled->contains(k);
+                return hits;
+            });
+            R.run(base + "/successor", params, n, [&] {
+                long long sum = 0;
+                for (int k : probes) sum += filled->successor(k);
+                return sum;
+            });
+        }
+    }
+}
+
+// ------------------------------ Arbor cases ----------------------------------
+static void bench_ensure_node(Bench_Runner& R, const Bench_Config& cfg) {
+    size_t n = cfg.quick ? 1 << 14 : 1 << 18;
+    vector<string> names(n);
+    mt19937 rng(3);
+    for (auto& s : names) s = "concept_" + to_string(rng());
+    R.run("ensure_node/new", {{"n", (long long)n}}, n, [&] {
+        Arbor A(256, true);
+        for (auto& s : names) A.ensure_node(s);
+        return (long long)A.size();
+    });
+    Arbor A(256, true);
+    for (auto& s : names) A.ensure_node(s);
+    R.run("ensure_node/existing", {{"n", (long long)n}}, n, [&] {
+        long long sum = 0;
+        for (auto& s : names) sum += A.ensure_node(s);
+        return sum;
+    });
+}
+
+// Build + freeze + drop of a whole taxonomy, with everything on the global heap
+// vs in one monotonic arena per tree (ops = nodes).
+static void bench_arena(Bench_Runner& R, const Bench_Config& cfg) {
+    int levels = cfg.quick ? 7 : 9;
+    for (Index_Kind kind : {Index_Kind::VEB, Index_Kind::VEB_FLAT}) {
+        string name = kind == Index_Kind::VEB ? "veb_lazy" : "veb_flat";
+        long long nodes = 0;
+        for (long long w = 1, l = 0; l < levels; ++l, w *= 4) nodes += w;
+        vector<pair<string,long long>> params = {{"n", nodes}};
+        R.run("build_drop/" + name + "/global_heap", params, (size_t)nodes, [&] {
+            Arbor A(256, true, kind);
+            build_synthetic_porhyry(A, levels, 4);
+            A.freeze();
+            return (long long)A.size();
+        });
+        R.run("build_drop/" + name + "/monotonic", params, (size_t)nodes, [&] {
+            pmr::monotonic_buffer_resource arena(1 << 20);
+            Arbor A(256, true, kind, &arena);
+            build_synthetic_porhyry(A, levels, 4);
+            A.freeze();
+            return (long long)A.size();
+        });
+    }
+}
+
+static void bench_paths(Bench_Runner& R, const Bench_Config& cfg) {
+    // (levels, branching) sweeps depth vs breadth.
+    vector<pair<int,int>> shapes = cfg.quick ? vector<pair<int,int>>{{6, 3}, {10, 2}}
+                                             : vector<pair<int,int>>{{6, 4}, {9, 4}, {12, 2}, {16, 2}, {5, 16}};
+    for (auto [levels, B] : shapes) {
+        Arbor A(256, true);
+        build_synthetic_porhyry(A, levels, B);
+        int n = A.size();
+        vector<pair<string,string>> pairs;
+        vector<int> ia = random_keys(1024, n, 4), ib = random_keys(1024, n, 5);
+        for (size_t i = 0; i < ia.size(); ++i) pairs.emplace_back(string(A.label_of(ia[i])), string(A.label_of(ib[i])));
+        vector<pair<string,long long>> params = {{"levels", levels}, {"B", B}, {"n", n}};
+
+        // Unfrozen, no tree index: a bidirectional BFS over vector<vector<int>> adjacency.
+        size_t slow_ops = min<size_t>(pairs.size(), max<size_t>(8, (size_t)(4000000 / max(n, 1))));
+        R.run("shortest_path/bfs", params, slow_ops, [&] {
+            long long sum = 0;
+            for (size_t i = 0; i < slow_ops; ++i) sum += (long long)A.shortest_path(pairs[i].first, pairs[i].second).size();
+            return sum;
+        });
+        R.run("shortest_path/dfs", params, slow_ops, [&] {
+            long long sum = 0;
+            for (size_t i = 0; i < slow_ops; ++i) sum += (long long)A.shortest_path_dfs(pairs[i].first, pairs[i].second).size();
+            return sum;
+        });
+        // Repeated pairs (warmup fills the cache, so this measures the hit path).
+        A.enable_path_cache(64 << 20);
+        R.run("shortest_path/bfs_cached", params, slow_ops, [&] {
+            long long sum = 0;
+            for (size_t i = 0; i < slow_ops; ++i) sum += (long long)A.shortest_path(pairs[i].first, pairs[i].second).size();
+            return sum;
+        });
+        A.disable_path_cache();
+        A.freeze();
+        R.run("shortest_path/lca", params, pairs.size(), [&] {
+            long long sum = 0;
+            for (auto& p : pairs) sum += (long long)A.shortest_path(p.first, p.second).size();
+            return sum;
+        });
+        R.run("distance/lca", params, pairs.size(), [&] {
+            long long sum = 0;
+            for (auto& p : pairs) sum += A.distance(p.first, p.second);
+            return sum;
+        });
+
+        // Ancestry: binary-lifting walk vs the O(1) preorder interval test.
+        R.run("is_descendant/lca", params, ia.size(), [&] {
+            long long hits = 0;
+            for (size_t i = 0; i < ia.size(); ++i) hits += A.lca(ia[i], ib[i]) == ib[i];
+            return hits;
+        });
+        A.build_intervals();
+        R.run("is_descendant/interval", params, ia.size(), [&] {
+            long long hits = 0;
+            for (size_t i = 0; i < ia.size(); ++i) hits += A.is_descendant(ia[i], ib[i]);
+            return hits;
+        });
+        // Batch ancestry: 10k candidates against one genus (a depth-1 concept).
+        vector<int> cand = random_keys(10000, n, 6);
+        int genus = A.children(0).empty() ? 0 : *A.children(0).begin();
+        vector<int> matched;
+        R.run("ancestry_batch/loop", params, cand.size(), [&] {
+            matched.clear();
+            for (int c : cand) if (A.is_descendant(c, genus)) matched.push_back(c);
+            return (long long)matched.size();
+        });
+        R.run("ancestry_batch/filter", params, cand.size(), [&] {
+            return (long long)A.filter_descendants(cand.data(), cand.size(), &genus, 1, matched);
+        });
+    }
+}
+
+// Weighted shortest paths on a tree with random cross-links (so the LCA
+// shortcut does not apply): one-sided vs bidirectional radix-heap Dijkstra.
+static void bench_weighted(Bench_Runner& R, const Bench_Config& cfg) {
+    vector<pair<int,int>> shapes = cfg.quick ? vector<pair<int,int>>{{7, 3}} : vector<pair<int,int>>{{9, 4}, {16, 2}};
+    for (auto [levels, B] : shapes) {
+        Arbor A(256, true);
+        build_synthetic_porhyry(A, levels, B);
+        int n = A.size();
+        mt19937 rng(8);
+        vector<int> xa = random_keys((size_t)n / 16, n, 9), xb = random_keys((size_t)n / 16, n, 10);
+        for (size_t i = 0; i < xa.size(); ++i) A.connect_ids(xa[i], xb[i], 1 + rng() % 100);
+        A.freeze();
+        vector<int> ia = random_keys(256, n, 11), ib = random_keys(256, n, 12);
+        vector<pair<string,long long>> params = {{"levels", levels}, {"B", B}, {"n", n}};
+        for (bool bi : {false, true}) {
+            R.run(bi ? "weighted_path/bidirectional" : "weighted_path/dijkstra", params, ia.size(), [&] {
+                long long sum = 0;
+                for (size_t i = 0; i < ia.size(); ++i) sum += A.weighted_path(ia[i], ib[i], thread_workspace(), nullptr, bi);
+                return sum;
+            });
+        }
+    }
+}
+
+// Hop paths on broad, shallow trees with random cross-links (no tree index):
+// one-sided vs bidirectional BFS.
+static void bench_bfs(Bench_Runner& R, const Bench_Config& cfg) {
+    vector<pair<int,int>> shapes = cfg.quick ? vector<pair<int,int>>{{4, 8}} : vector<pair<int,int>>{{5, 16}, {4, 48}};
+    for (auto [levels, B] : shapes) {
+        Arbor A(256, true);
+        build_synthetic_porhyry(A, levels, B);
+        int n = A.size();
+        vector<int> xa = random_keys((size_t)n / 32, n, 13), xb = random_keys((size_t)n / 32, n, 14);
+        for (size_t i = 0; i < xa.size(); ++i) A.connect_ids(xa[i], xb[i]);
+        A.freeze();
+        vector<int> ia = random_keys(256, n, 15), ib = random_keys(256, n, 16);
+        vector<pair<string,long long>> params = {{"levels", levels}, {"B", B}, {"n", n}};
+        Arbor::Bfs_Scratch one;
+        Arbor::Bidi_Scratch two;
+        vector<int> path;
+        R.run("bfs/one_sided", params, ia.size(), [&] {
+            long long sum = 0;
+            for (size_t i = 0; i < ia.size(); ++i) { path.clear(); sum += A.bfs_path(ia[i], ib[i], one, path); }
+            return sum;
+        });
+        R.run("bfs/bidirectional", params, ia.size(), [&] {
+            long long sum = 0;
+            for (size_t i = 0; i < ia.size(); ++i) { path.clear(); sum += A.bidirectional_bfs(ia[i], ib[i], two, path); }
+            return sum;
+        });
+    }
+}
+
+// Whole-taxonomy distances: one-to-all BFS and the mapped all-pairs matrix
+// (LCA tiles with the tree index, one BFS per row without it).
+static void bench_all_pairs(Bench_Runner& R, const Bench_Config& cfg) {
+    int levels = cfg.quick ? 6 : 8, B = 3;
+    Arbor A(256, true);
+    build_synthetic_porhyry(A, levels, B);
+    A.freeze();
+    int n = A.size();
+    vector<pair<string,long long>> params = {{"levels", levels}, {"B", B}, {"n", n}};
+    vector<int> row(n);
+    R.run("one_to_all/bfs", params, (size_t)n, [&] {
+        A.distances_from(n / 2, row.data());
+        return (long long)row[0];
+    });
+    string file = "bench_tmp.apd";
+    R.run("all_pairs/lca_tiles", params, (size_t)n * n, [&] { return (long long)write_distance_matrix(A, file); });
+    R.run("all_pairs/bfs_rows", params, (size_t)n * n, [&] { return (long long)write_distance_matrix(A, file, 0, 256, true); });
+    remove(file.c_str());
+}
+
+// Leaf additions under a frozen tree: incremental index upkeep vs rebuilding
+// the tree index after every insert (what each insert cost before). Leaves
+// accumulate across repetitions so no copy of the tree is timed.
+static void bench_updates(Bench_Runner& R, const Bench_Config& cfg) {
+    int levels = cfg.quick ? 8 : 12, B = 3;
+    size_t leaves = cfg.quick ? 256 : 2048;
+    for (bool incremental : {true, false}) {
+        Arbor A(256, true);
+        build_synthetic_porhyry(A, levels, B);
+        A.freeze();
+        int n = A.size();
+        vector<int> parents = random_keys(leaves, n, 7);
+        vector<pair<string,long long>> params = {{"levels", levels}, {"B", B}, {"n", n}};
+        size_t ops = incremental ? leaves : min<size_t>(leaves, 64);
+        long long serial = 0;
+        R.run(incremental ? "insert_leaf/incremental" : "insert_leaf/rebuild", params, ops, [&] {
+            char name[32] = "leaf_";
+            for (size_t i = 0; i < ops; ++i) {
+                char* e = to_chars(name + 5, name + sizeof(name), serial++).ptr;
+                A.connect_ids(parents[i], A.ensure_node(string_view(name, (size_t)(e - name))));
+                if (!incremental) A.build_tree_index();
+            }
+            return (long long)A.tree_ready;
+        });
+    }
+}
+
+static void bench_exports(Bench_Runner& R, const Bench_Config& cfg) {
+    vector<pair<int,int>> shapes = cfg.quick ? vector<pair<int,int>>{{8, 3}} : vector<pair<int,int>>{{8, 4}, {18, 2}};
+    for (auto [levels, B] : shapes) {
+        Arbor A(256, true);
+        build_synthetic_porhyry(A, levels, B);
+        A.freeze();
+        vector<pair<string,long long>> params = {{"levels", levels}, {"B", B}, {"n", A.size()}};
+        Null_Buffer nb;
+        ostream null_out(&nb);
+        R.run("export/ascii", params, (size_t)A.size(), [&] {
+            print_ascii_tree_from_root(A, "L1_0", -1, 0, null_out);
+            return (long long)A.size();
+        });
+        string dot = "bench_tmp.dot";
+        R.run("export/dot", params, (size_t)A.size(), [&] {
+            cerr.setstate(ios::failbit);   // silence the per-file message
+            auto files = emit_graphviz(A, dot);
+            cerr.clear();
+            return (long long)files.size();
+        });
+        remove(dot.c_str());
+    }
+}
+
+int main(int argc, char** argv){
+    Bench_Config cfg;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        auto next = [&]() -> string {
+            if (i + 1 >= argc) { cerr << "missing value for " << a << "\n"; exit(2); }
+            return argv[++i];
+        };
+        if (a == "--quick") cfg.quick = true;
+        else if (a == "--reps") cfg.reps = max(1, stoi(next()));
+        else if (a == "--warmup") cfg.warmup = max(0, stoi(next()));
+        else if (a == "--filter") cfg.filter = next();
+        else if (a == "--json") cfg.json_path = next();
+        else { cerr << "unknown option: " << a << "\n"; return 2; }
+    }
+
+    Bench_Runner R(cfg);
+    bench_vebs(R, cfg);
+    bench_indexes(R, cfg);
+    bench_ensure_node(R, cfg);
+    bench_arena(R, cfg);
+    bench_paths(R, cfg);
+    bench_updates(R, cfg);
+    bench_weighted(R, cfg);
+    bench_bfs(R, cfg);
+    bench_all_pairs(R, cfg);
+    bench_exports(R, cfg);
+    if (!cfg.json_path.empty()) R.write_json(cfg.json_path);
+    return 0;
+}
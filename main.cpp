@@ -1,178 +1,3276 @@
 // Arbor Porphyriana modeled with a Van Emde Boas Tree (VEB)
-// + Dijkstra (unit weights) with timing + ASCII & Graphviz diagrams (ASCII-only).
+// + Dijkstra (radix heap, optional edge weights) with timing + ASCII & Graphviz diagrams (ASCII-only).
 //
 // Build & run (example):
-//   g++ -std=c++17 -O2 -o arbor main.cpp && ./arbor
+//   g++ -std=c++17 -O2 -pthread -o arbor main.cpp && ./arbor
+//
+// Benchmarks (see bench.cpp):
+//   g++ -std=c++17 -O2 -pthread -o arbor_bench bench.cpp && ./arbor_bench --json bench.json
+//
+// Tests (see tests.cpp; also meant for -fsanitize=address,undefined / thread):
+//   g++ -std=c++17 -O2 -pthread -o arbor_tests tests.cpp && ./arbor_tests
+//
+// SIMD batch ancestry (AVX2; AArch64 uses NEON by default):
+//   g++ -std=c++17 -O2 -pthread -mavx2 -o arbor main.cpp
+//
+// Hot-path counters and timers (printed at exit; see dump_stats()):
+//   g++ -std=c++17 -O2 -pthread -DARBOR_STATS -o arbor main.cpp
+//
+// Heap tracing (peak bytes per build step on stderr; glibc or macOS):
+//   g++ -std=c++17 -O2 -pthread -DARBOR_TRACE_ALLOC -o arbor main.cpp
 //
 // Diagram (Graphviz):
 //   dot -Tpng porphyry.dot -o porphyry.png
 //
 // What this program does:
-// 1) Implements a Van Emde Boas (VEB) tree to index all concept IDs.
+// 1) Implements a Van Emde Boas (VEB) tree to index all concept IDs (the index
+//    backend is pluggable: VEB variants, bitset, sorted vector, std::set).
+//    An Arbor and its index can allocate from a std::pmr::memory_resource.
 // 2) Builds a Porphyrian-style taxonomy (sample "animal -> feline/canine -> cat... dog...",
 //    plus a generator for an N-level synthetic tree).
-// 3) Measures and prints build time and Dijkstra time (shortest path between terms).
-// 4) Prints a compact textual view of the VEB clusters with their labels.
+// 3) Measures and prints build time and Dijkstra time (shortest path between terms),
+//    plus an LCA (binary lifting) index that answers tree distances in O(log n).
+// 4) Prints a compact textual view of the indexed IDs (in fixed-width buckets)
+//    with their labels,
+//    and the memory footprint by component (Arbor::memory_usage()).
 // 5) Renders the taxonomy as:
 //    - ASCII tree in the console (ASCII characters only for portability).
 //    - Graphviz DOT file (porphyry.dot) for a clean diagram.
 //
 
-#include <bits/stdc++.h>
-using namespace std;
-using namespace std::chrono;
+#include <bits/stdc++.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#if defined(ARBOR_TRACE_ALLOC) && defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(ARBOR_TRACE_ALLOC)
+#include <malloc.h>
+#endif
+using namespace std;
+using namespace std::chrono;
+
+// ----------------------------- Parallel helpers -------------------------------
+// Splits [0, n) into one contiguous chunk per worker and runs fn(begin, end, tid)
+// on each; threads <= 0 means "one per hardware thread". Runs inline when a
+// single worker suffices.
+template <class Fn>
+void parallel_for(size_t n, int threads, Fn&& fn) {
+    if (threads <= 0) threads = (int)max(1u, std::thread::hardware_concurrency());
+    threads = (int)min<size_t>((size_t)threads, max<size_t>(n, 1));
+    if (threads == 1) { fn((size_t)0, n, 0); return; }
+    vector<std::thread> pool;
+    pool.reserve(threads);
+    size_t chunk = (n + threads - 1) / threads;
+    for (int t = 0; t < threads; ++t) {
+        size_t b = min(n, t * chunk), e = min(n, b + chunk);
+        pool.emplace_back([&fn, b, e, t] { fn(b, e, t); });
+    }
+    for (auto& th : pool) th.join();
+}
+
+// ------------------------------ Instrumentation -------------------------------
+// Build with -DARBOR_STATS to count hot-path events and time the main
+// operations; dump_stats() prints them as text or JSON. Without the flag the
+// ARBOR_COUNT / ARBOR_TIMER macros expand to nothing, so hot loops are unchanged.
+// Counters are relaxed atomics shared by all threads.
+#define ARBOR_STAT_COUNTERS(X)                                                  \
+    X(veb_inserts)          /* top-level index inserts */                      \
+    X(veb_insert_levels)    /* recursion levels visited by those inserts */    \
+    X(veb_nodes_allocated)  /* VEB nodes created (flat: arena nodes) */        \
+    X(label_lookups)        /* interner hash lookups */                        \
+    X(label_probes)         /* slots inspected by those lookups */             \
+    X(path_queries)         /* shortest_path / distance calls */               \
+    X(path_nodes_settled)   /* nodes popped by Dijkstra / BFS */               \
+    X(path_heap_pushes)     /* heap / queue pushes by Dijkstra / BFS */        \
+    X(graphviz_bytes)       /* bytes written by emit_graphviz */
+#define ARBOR_STAT_TIMERS(X) X(freeze) X(shortest_path) X(emit_graphviz) X(load_edges)
+
+#ifdef ARBOR_STATS
+struct Arbor_Stats {
+#define ARBOR_STAT_FIELD(n) std::atomic<uint64_t> n{0};
+#define ARBOR_TIMER_FIELDS(n) std::atomic<uint64_t> n##_calls{0}, n##_ns{0};
+    ARBOR_STAT_COUNTERS(ARBOR_STAT_FIELD)
+    ARBOR_STAT_TIMERS(ARBOR_TIMER_FIELDS)
+#undef ARBOR_STAT_FIELD
+#undef ARBOR_TIMER_FIELDS
+};
+
+inline Arbor_Stats& arbor_stats() { static Arbor_Stats s; return s; }
+
+// Adds its lifetime to a (calls, ns) timer pair.
+class Scoped_Timer {
+public:
+    Scoped_Timer(std::atomic<uint64_t>& c, std::atomic<uint64_t>& t): calls(c), ns(t), t0(steady_clock::now()) {}
+    ~Scoped_Timer() {
+        calls.fetch_add(1, memory_order_relaxed);
+        ns.fetch_add((uint64_t)duration_cast<nanoseconds>(steady_clock::now() - t0).count(), memory_order_relaxed);
+    }
+    Scoped_Timer(const Scoped_Timer&) = delete;
+    Scoped_Timer& operator=(const Scoped_Timer&) = delete;
+
+private:
+    std::atomic<uint64_t>& calls;
+    std::atomic<uint64_t>& ns;
+    steady_clock::time_point t0;
+};
+
+#define ARBOR_COUNT(name, n) arbor_stats().name.fetch_add((uint64_t)(n), memory_order_relaxed)
+#define ARBOR_TIMER(name) Scoped_Timer arbor_timer_##name(arbor_stats().name##_calls, arbor_stats().name##_ns)
+#else
+#define ARBOR_COUNT(name, n) ((void)0)
+#define ARBOR_TIMER(name) ((void)0)
+#endif
+
+// Prints all counters and timers; reports "disabled" when built without ARBOR_STATS.
+inline void dump_stats(ostream& os = cout, bool json = false) {
+#ifdef ARBOR_STATS
+    Arbor_Stats& st = arbor_stats();
+    const char* sep = "";
+    if (json) os << "{\"enabled\": true, \"counters\": {";
+    else os << "--- Stats ---\n";
+#define ARBOR_PRINT_COUNTER(n)                                                        \
+    if (json) os << sep << "\"" #n "\": " << st.n.load(); else os << #n << ": " << st.n.load() << "\n"; \
+    sep = ", ";
+    ARBOR_STAT_COUNTERS(ARBOR_PRINT_COUNTER)
+#undef ARBOR_PRINT_COUNTER
+    sep = "";
+    if (json) os << "}, \"timers\": {";
+#define ARBOR_PRINT_TIMER(n)                                                          \
+    if (json) os << sep << "\"" #n "\": {\"calls\": " << st.n##_calls.load() << ", \"ns\": " << st.n##_ns.load() << "}"; \
+    else os << #n << ": " << st.n##_calls.load() << " calls, " << st.n##_ns.load() / 1000 << " us\n"; \
+    sep = ", ";
+    ARBOR_STAT_TIMERS(ARBOR_PRINT_TIMER)
+#undef ARBOR_PRINT_TIMER
+    if (json) os << "}}\n";
+#else
+    if (json) os << "{\"enabled\": false}\n";
+    else os << "--- Stats --- (disabled; build with -DARBOR_STATS)\n";
+#endif
+}
+
+// Zeroes all counters and timers (no-op without ARBOR_STATS).
+inline void reset_stats() {
+#ifdef ARBOR_STATS
+    Arbor_Stats& st = arbor_stats();
+#define ARBOR_RESET_COUNTER(n) st.n.store(0, memory_order_relaxed);
+#define ARBOR_RESET_TIMER(n) st.n##_calls.store(0, memory_order_relaxed); st.n##_ns.store(0, memory_order_relaxed);
+    ARBOR_STAT_COUNTERS(ARBOR_RESET_COUNTER)
+    ARBOR_STAT_TIMERS(ARBOR_RESET_TIMER)
+#undef ARBOR_RESET_COUNTER
+#undef ARBOR_RESET_TIMER
+#endif
+}
+
+// ------------------------------ Memory accounting -----------------------------
+// memory_usage() on Arbor and the ID indexes fills a Memory_Report: payload
+// bytes per component (container capacity, not size), an estimate of what the
+// allocator adds on top, and for VEB indexes the nodes and bytes per recursion
+// level (0 = root). The estimate models a glibc-style malloc: an 8-byte header
+// per block, rounded up to 16, with a 32-byte minimum.
+inline size_t heap_block_bytes(size_t n) { return n ? std::max<size_t>(32, (n + 8 + 15) & ~(size_t)15) : 0; }
+
+struct Memory_Report {
+    struct Part {
+        string name;
+        size_t bytes = 0;        // payload
+        size_t overhead = 0;     // estimated headers and rounding
+        size_t allocations = 0;  // heap blocks
+    };
+    struct Level {
+        size_t nodes = 0;
+        size_t bytes = 0;        // node payload at this depth (children excluded)
+        size_t overhead = 0;
+    };
+    vector<Part> parts;
+    vector<Level> veb_levels;
+
+    // One heap block of n payload bytes (nothing if n == 0).
+    void add_block(const string& part, size_t n) { add_blocks(part, n, n ? 1 : 0); }
+    // count blocks of n bytes each (node-based containers).
+    void add_blocks(const string& part, size_t n, size_t count) {
+        if (!n || !count) return;
+        Part& pt = find_part(part);
+        pt.bytes += n * count;
+        pt.overhead += (heap_block_bytes(n) - n) * count;
+        pt.allocations += count;
+    }
+    template <class Vec>
+    void add_vector(const string& part, const Vec& v) { add_block(part, v.capacity() * sizeof(typename Vec::value_type)); }
+    void add_level(int depth, size_t nodes, size_t bytes, size_t overhead) {
+        if ((int)veb_levels.size() <= depth) veb_levels.resize(depth + 1);
+        veb_levels[depth].nodes += nodes;
+        veb_levels[depth].bytes += bytes;
+        veb_levels[depth].overhead += overhead;
+    }
+
+    size_t payload_bytes() const { size_t n = 0; for (auto& p : parts) n += p.bytes; return n; }
+    size_t overhead_bytes() const { size_t n = 0; for (auto& p : parts) n += p.overhead; return n; }
+    size_t allocations() const { size_t n = 0; for (auto& p : parts) n += p.allocations; return n; }
+    // Estimated resident heap: what a memory budget should be checked against.
+    size_t total_bytes() const { return payload_bytes() + overhead_bytes(); }
+
+    void print(ostream& os = cout, bool json = false) const {
+        if (json) {
+            os << "{\"total_bytes\": " << total_bytes() << ", \"payload_bytes\": " << payload_bytes()
+               << ", \"overhead_bytes\": " << overhead_bytes() << ", \"allocations\": " << allocations() << ", \"parts\": [";
+            for (size_t i = 0; i < parts.size(); ++i) {
+                const Part& p = parts[i];
+                os << (i ? ", " : "") << "{\"name\": \"" << p.name << "\", \"bytes\": " << p.bytes
+                   << ", \"overhead\": " << p.overhead << ", \"allocations\": " << p.allocations << "}";
+            }
+            os << "], \"veb_levels\": [";
+            for (size_t d = 0; d < veb_levels.size(); ++d) {
+                const Level& l = veb_levels[d];
+                os << (d ? ", " : "") << "{\"nodes\": " << l.nodes << ", \"bytes\": " << l.bytes
+                   << ", \"overhead\": " << l.overhead << "}";
+            }
+            os << "]}\n";
+            return;
+        }
+        os << "--- Memory: " << total_bytes() << " B (" << payload_bytes() << " B payload + ~"
+           << overhead_bytes() << " B allocator overhead, " << allocations() << " allocations) ---\n";
+        for (const Part& p : parts) {
+            os << p.name << ": " << p.bytes << " B (+" << p.overhead << " B, " << p.allocations << " allocations)\n";
+        }
+        for (size_t d = 0; d < veb_levels.size(); ++d) {
+            const Level& l = veb_levels[d];
+            os << "veb level " << d << ": " << l.nodes << " nodes, " << l.bytes << " B (+" << l.overhead << " B)\n";
+        }
+    }
+
+private:
+    Part& find_part(const string& name) {
+        for (Part& p : parts) if (p.name == name) return p;
+        parts.push_back({name});
+        return parts.back();
+    }
+};
+
+// Heap tracing (-DARBOR_TRACE_ALLOC): the global operator new/delete below
+// keep live heap bytes (usable block sizes, so allocator rounding is included),
+// their high-water mark and allocation counts. ARBOR_ALLOC_SCOPE(name) reports
+// on cerr the peak reached inside a block relative to where it started.
+// Without the flag the macro expands to nothing and new/delete are untouched.
+#ifdef ARBOR_TRACE_ALLOC
+#if defined(__APPLE__)
+#define ARBOR_BLOCK_SIZE(p) malloc_size(p)
+#elif defined(__GLIBC__)
+#define ARBOR_BLOCK_SIZE(p) malloc_usable_size(p)
+#else
+#error "ARBOR_TRACE_ALLOC needs malloc_usable_size (glibc) or malloc_size (macOS)"
+#endif
+
+struct Alloc_Trace {
+    std::atomic<long long> live{0}, peak{0};
+    std::atomic<uint64_t> allocations{0}, frees{0};
+
+    void on_alloc(void* p) {
+        long long n = (long long)ARBOR_BLOCK_SIZE(p);
+        long long now = live.fetch_add(n, memory_order_relaxed) + n;
+        allocations.fetch_add(1, memory_order_relaxed);
+        raise_peak(now);
+    }
+    void on_free(void* p) {
+        if (!p) return;
+        live.fetch_sub((long long)ARBOR_BLOCK_SIZE(p), memory_order_relaxed);
+        frees.fetch_add(1, memory_order_relaxed);
+    }
+    void raise_peak(long long v) {
+        long long pk = peak.load(memory_order_relaxed);
+        while (v > pk && !peak.compare_exchange_weak(pk, v, memory_order_relaxed)) {}
+    }
+};
+
+// Constant-initialized, so it is usable from the very first allocation.
+inline Alloc_Trace& alloc_trace() { static Alloc_Trace t; return t; }
+
+// Resets the high-water mark to the current level for its lifetime, reports
+// the peak on exit, and then restores any higher outer mark (scopes nest).
+class Alloc_Scope {
+public:
+    explicit Alloc_Scope(const char* what)
+        : name(what), live0(alloc_trace().live.load(memory_order_relaxed)),
+          outer_peak(alloc_trace().peak.exchange(live0, memory_order_relaxed)),
+          allocs0(alloc_trace().allocations.load(memory_order_relaxed)) {}
+    ~Alloc_Scope() {
+        Alloc_Trace& t = alloc_trace();
+        long long pk = t.peak.load(memory_order_relaxed);
+        cerr << "[alloc] " << name << ": peak +" << pk - live0 << " B, net "
+             << t.live.load(memory_order_relaxed) - live0 << " B, "
+             << t.allocations.load(memory_order_relaxed) - allocs0 << " allocations\n";
+        t.raise_peak(outer_peak);
+    }
+    Alloc_Scope(const Alloc_Scope&) = delete;
+    Alloc_Scope& operator=(const Alloc_Scope&) = delete;
+
+private:
+    const char* name;
+    long long live0, outer_peak;
+    uint64_t allocs0;
+};
+
+void* operator new(size_t n) {
+    void* p = malloc(n ? n : 1);
+    if (!p) throw bad_alloc();
+    alloc_trace().on_alloc(p);
+    return p;
+}
+void* operator new(size_t n, align_val_t a) {
+    void* p = nullptr;
+    if (posix_memalign(&p, std::max(sizeof(void*), (size_t)a), n ? n : 1)) throw bad_alloc();
+    alloc_trace().on_alloc(p);
+    return p;
+}
+void* operator new[](size_t n) { return operator new(n); }
+void* operator new[](size_t n, align_val_t a) { return operator new(n, a); }
+void operator delete(void* p) noexcept { alloc_trace().on_free(p); free(p); }
+void operator delete(void* p, align_val_t) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { operator delete(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete[](void* p, align_val_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { operator delete(p); }
+
+#define ARBOR_ALLOC_SCOPE(name) Alloc_Scope arbor_alloc_scope_##name(#name)
+#else
+#define ARBOR_ALLOC_SCOPE(name) ((void)0)
+#endif
+
+// ------------------------------ Mapped files ---------------------------------
+// Read-only view of a whole file: mmap on POSIX; elsewhere the file is read
+// into memory (same interface, but not zero-copy).
+class Mapped_File {
+public:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    Mapped_File() = default;
+    Mapped_File(const Mapped_File&) = delete;
+    Mapped_File& operator=(const Mapped_File&) = delete;
+    ~Mapped_File() { close(); }
+
+    bool open(const string& path) {
+        close();
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        if (size) {
+            void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); size = 0; return false; }
+            data = (const char*)p;
+        }
+        ::close(fd);
+        return true;
+#else
+        ifstream in(path, ios::binary);
+        if (!in) return false;
+        copy.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = copy.data();
+        size = copy.size();
+        return true;
+#endif
+    }
+
+    void close() {
+#if !defined(_WIN32)
+        if (data) munmap((void*)data, size);
+#else
+        copy.clear();
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+private:
+#if defined(_WIN32)
+    vector<char> copy;
+#endif
+};
+
+// Writable file of a fixed size: a shared mapping on POSIX (pages go straight
+// to the file); elsewhere a memory buffer written out by close(). The blocks
+// are allocated before mapping, so a full disk fails create() instead of
+// raising SIGBUS on a later store.
+class Mapped_Output {
+public:
+    char* data = nullptr;
+    size_t size = 0;
+
+    Mapped_Output() = default;
+    Mapped_Output(const Mapped_Output&) = delete;
+    Mapped_Output& operator=(const Mapped_Output&) = delete;
+    ~Mapped_Output() { close(); }
+
+    bool create(const string& path, size_t bytes) {
+        close();
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+#if defined(__APPLE__)
+        bool sized = ftruncate(fd, (off_t)bytes) == 0;  // no posix_fallocate
+#else
+        bool sized = !bytes || posix_fallocate(fd, 0, (off_t)bytes) == 0;
+#endif
+        if (!sized) { ::close(fd); return false; }
+        if (bytes) {
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); return false; }
+            data = (char*)p;
+        }
+        ::close(fd);
+#else
+        target = path;
+        copy.assign(bytes, 0);
+        data = copy.data();
+#endif
+        size = bytes;
+        return true;
+    }
+
+    // Flushes and unmaps (or writes the buffer); false if the data could not
+    // be written.
+    bool close() {
+        bool ok = true;
+#if !defined(_WIN32)
+        if (data) {
+            ok = msync(data, size, MS_SYNC) == 0;
+            munmap(data, size);
+        }
+#else
+        if (data) {
+            ofstream out(target, ios::binary | ios::trunc);
+            out.write(copy.data(), (streamsize)copy.size());
+            ok = (bool)out;
+        }
+        copy.clear();
+#endif
+        data = nullptr;
+        size = 0;
+        return ok;
+    }
+
+private:
+#if defined(_WIN32)
+    string target;
+    vector<char> copy;
+#endif
+};
+
+// ----------------------------- Van Emde Boas Tree -----------------------------
+// Forward iterator over the keys of a VEB, advanced with successor(); stops at
+// the first key >= limit. Shared by the VEB variants below.
+template <class Tree>
+struct Veb_Key_Iterator {
+    const Tree* tree;
+    int key;    // current key, -1 once exhausted
+    int limit;  // exclusive upper bound
+
+    int operator*() const { return key; }
+    Veb_Key_Iterator& operator++() {
+        key = tree->successor(key);
+        if (key >= limit) key = -1;
+        return *this;
+    }
+    bool operator==(const Veb_Key_Iterator& o) const { return key == o.key; }
+    bool operator!=(const Veb_Key_Iterator& o) const { return key != o.key; }
+};
+
+template <class Tree>
+struct Veb_Key_Range {
+    Veb_Key_Iterator<Tree> first;
+    Veb_Key_Iterator<Tree> begin() const { return first; }
+    Veb_Key_Iterator<Tree> end() const { return {first.tree, -1, first.limit}; }
+};
+
+// Shared insert_sorted() for the VEB variants. An empty tree is filled by its
+// fill_sorted(), which works bottom-up in one sequential pass per level
+// instead of repeating the top-down descent for every key; a non-empty tree
+// takes the keys one insert() at a time. keys must be sorted; duplicates are
+// dropped.
+template <class Tree>
+void veb_insert_sorted(Tree& t, const int* keys, size_t n) {
+    if (n == 0) return;
+    if (!t.empty()) { for (size_t i = 0; i < n; ++i) t.insert(keys[i]); return; }
+    vector<int> work(n), tmp(n);
+    size_t m = (size_t)(unique_copy(keys, keys + n, work.begin()) - work.begin());
+    t.fill_sorted(work.data(), m, tmp.data());
+}
+
+// Shared parallel scan: the top-level clusters (blocks of span keys) that
+// overlap [lo, hi) are split into one contiguous run per worker, and each
+// worker walks its run with t.for_each_in_range, calling fn(key, tid). Runs
+// are assigned in tid order, so concatenating the per-tid outputs in tid order
+// gives the keys in increasing order. u is t's universe.
+template <class Tree, class Fn>
+void veb_parallel_for_each(const Tree& t, int lo, int hi, int u, int span, int threads, Fn&& fn) {
+    lo = std::max(lo, 0);
+    hi = std::min(hi, u);
+    if (hi <= lo) return;
+    size_t first = (size_t)lo / span, last = (size_t)(hi - 1) / span + 1;
+    parallel_for(last - first, threads, [&](size_t b, size_t e, int tid) {
+        int from = (int)std::max<long long>(lo, (long long)(first + b) * span);
+        int to = (int)std::min<long long>(hi, (long long)(first + e) * span);
+        t.for_each_in_range(from, to, [&](int k) { fn(k, tid); });
+    });
+}
+
+// Memory resources: the Arbor containers and the VEB nodes can be placed in a
+// caller-supplied std::pmr::memory_resource (e.g. one monotonic arena per
+// taxonomy). Null means pmr::get_default_resource(). As with pmr containers,
+// the resource does not travel with copies: a copy allocates from the default.
+inline pmr::memory_resource* resource_or_default(pmr::memory_resource* m) {
+    return m ? m : pmr::get_default_resource();
+}
+
+// Node allocation for the pointer-based VEBs, from the tree's resource.
+template <class Node, class... Args>
+Node* new_node(pmr::memory_resource* mem, Args&&... args) {
+    void* p = mem->allocate(sizeof(Node), alignof(Node));
+    return ::new (p) Node(std::forward<Args>(args)...);
+}
+
+template <class Node>
+void delete_node(pmr::memory_resource* mem, Node* n) {
+    if (!n) return;
+    n->~Node();
+    mem->deallocate(n, sizeof(Node), alignof(Node));
+}
+
+class Van_Emde_Boas {
+public:
+    int universe_size;  // U
+    int minimum;        // min key or -1 if empty
+    int maximum;        // max key or -1 if empty
+    Van_Emde_Boas* summary;                 // VEB(sqrt(U))
+    pmr::vector<Van_Emde_Boas*> clusters;   // sqrt(U) clusters, each VEB(sqrt(U))
+    bool lazy;                              // create summary/clusters on first insert
+    pmr::memory_resource* mem;              // where summary, clusters and the vector live
+
+    // lazy_alloc=false builds the whole recursion up front (original behaviour).
+    // lazy_alloc=true only allocates what insert() touches, so a large U is cheap
+    // for sparse key sets; a missing summary/cluster is treated as empty.
+    explicit Van_Emde_Boas(int size, bool lazy_alloc = false, pmr::memory_resource* resource = nullptr)
+        : universe_size(size), minimum(-1), maximum(-1), summary(nullptr),
+          clusters(resource_or_default(resource)), lazy(lazy_alloc), mem(resource_or_default(resource)) {
+        ARBOR_COUNT(veb_nodes_allocated, 1);
+        if (size > 2 && !lazy) {
+            int no_clusters = (int)ceil(sqrt((double)size));
+            summary = new_node<Van_Emde_Boas>(mem, no_clusters, false, mem);
+            clusters.assign(no_clusters, nullptr);
+            for (int i = 0; i < no_clusters; i++) {
+                clusters[i] = new_node<Van_Emde_Boas>(mem, (int)ceil(sqrt((double)size)), false, mem);
+            }
+        }
+    }
+
+    // Deep copy (used when Arbor versions are cloned), into resource (null: the default).
+    Van_Emde_Boas(const Van_Emde_Boas& o, pmr::memory_resource* resource = nullptr)
+        : universe_size(o.universe_size), minimum(o.minimum), maximum(o.maximum), summary(nullptr),
+          clusters(o.clusters.size(), nullptr, resource_or_default(resource)), lazy(o.lazy),
+          mem(resource_or_default(resource)) {
+        ARBOR_COUNT(veb_nodes_allocated, 1);
+        if (o.summary) summary = new_node<Van_Emde_Boas>(mem, *o.summary, mem);
+        for (size_t i = 0; i < clusters.size(); ++i) if (o.clusters[i]) clusters[i] = new_node<Van_Emde_Boas>(mem, *o.clusters[i], mem);
+    }
+    Van_Emde_Boas& operator=(const Van_Emde_Boas&) = delete;
+
+    ~Van_Emde_Boas() {
+        delete_node(mem, summary);
+        for (auto* c : clusters) delete_node(mem, c);
+    }
+
+    inline int high(int x) const { int d = (int)ceil(sqrt((double)universe_size)); return x / d; }
+    inline int low(int x)  const { int m = (int)ceil(sqrt((double)universe_size)); return x % m; }
+    inline int generate_index(int x, int y) const { int ru = (int)ceil(sqrt((double)universe_size)); return x * ru + y; }
+
+    inline bool empty() const { return minimum == -1; }
+
+    void empty_insert(int x) { minimum = maximum = x; }
+
+    bool contains(int x) const {
+        if (x == minimum || x == maximum) return true;
+        if (universe_size <= 2) return false;
+        int h = high(x), l = low(x);
+        if (h < 0 || h >= (int)clusters.size()) return false;
+        if (!clusters[h] || clusters[h]->empty()) return false;
+        return clusters[h]->contains(l);
+    }
+
+    void insert(int x) {
+        ARBOR_COUNT(veb_insert_levels, 1);
+        if (minimum == -1) { // empty tree
+            empty_insert(x);
+            return;
+        }
+        if (x == minimum || x == maximum) return;  // already present
+        if (x < minimum) std::swap(x, minimum);
+
+        if (universe_size > 2) {
+            int h = high(x);
+            int l = low(x);
+            if (lazy) materialize(h);
+            if (clusters[h]->minimum == -1) {
+                summary->insert(h);
+                clusters[h]->empty_insert(l);
+            } else {
+                clusters[h]->insert(l);
+            }
+        }
+        if (x > maximum) maximum = x;
+    }
+
+    // Bulk insert of sorted keys (see veb_insert_sorted).
+    void insert_sorted(const int* keys, size_t n) { veb_insert_sorted(*this, keys, n); }
+
+    // Fills this empty node from n >= 1 strictly increasing keys: min/max are
+    // taken directly, the rest are split into runs by high(), each run's lows
+    // fill its cluster, and the run heads fill the summary. keys and tmp (room
+    // for n) are both used as scratch.
+    void fill_sorted(int* keys, size_t n, int* tmp) {
+        ARBOR_COUNT(veb_insert_levels, 1);
+        minimum = keys[0];
+        maximum = keys[n - 1];
+        if (universe_size <= 2 || n == 1) return;
+        int ru = (int)ceil(sqrt((double)universe_size));
+        size_t m = 0;
+        for (size_t a = 1; a < n;) {
+            int h = keys[a] / ru;
+            size_t b = a;
+            for (; b < n && keys[b] / ru == h; ++b) keys[b] %= ru;
+            if (lazy) materialize(h);
+            clusters[h]->fill_sorted(keys + a, b - a, tmp + a);
+            tmp[m++] = h;   // m < a, so this never overlaps a cluster's scratch
+            a = b;
+        }
+        summary->fill_sorted(tmp, m, keys);
+    }
+
+    // ---- ordered-set API (all O(log log U); -1 means "none") ----
+    inline int min() const { return minimum; }
+    inline int max() const { return maximum; }
+
+    // Smallest key > x. x may be -1 (returns min()).
+    int successor(int x) const {
+        if (minimum == -1) return -1;
+        if (x < minimum) return minimum;
+        if (universe_size <= 2) return (x < maximum) ? maximum : -1;
+        int h = high(x), l = low(x);
+        const Van_Emde_Boas* c = cluster_at(h);
+        if (c && !c->empty() && l < c->maximum) return generate_index(h, c->successor(l));
+        int next = summary ? summary->successor(h) : -1;
+        if (next == -1) return -1;
+        return generate_index(next, clusters[next]->minimum);
+    }
+
+    // Largest key < x.
+    int predecessor(int x) const {
+        if (minimum == -1 || x <= minimum) return -1;
+        if (x > maximum) return maximum;
+        if (universe_size <= 2) return minimum;
+        int h = high(x), l = low(x);
+        const Van_Emde_Boas* c = cluster_at(h);
+        if (c && !c->empty() && l > c->minimum) return generate_index(h, c->predecessor(l));
+        int prev = summary ? summary->predecessor(h) : -1;
+        if (prev == -1) return minimum;
+        return generate_index(prev, clusters[prev]->maximum);
+    }
+
+    // Removes x; returns false if it was not present.
+    bool erase(int x) {
+        if (!contains(x)) return false;
+        erase_present(x);
+        return true;
+    }
+
+    void erase_present(int x) {
+        if (minimum == maximum) { minimum = maximum = -1; return; }
+        if (universe_size <= 2) { minimum = maximum = (x == minimum) ? maximum : minimum; return; }
+        if (x == minimum) {
+            // Pull the next key out of the clusters to become the new min.
+            int first = summary->minimum;
+            x = generate_index(first, clusters[first]->minimum);
+            minimum = x;
+        }
+        int h = high(x);
+        clusters[h]->erase_present(low(x));
+        if (clusters[h]->empty()) {
+            summary->erase_present(h);
+            if (x == maximum) {
+                int last = summary->maximum;
+                maximum = (last == -1) ? minimum : generate_index(last, clusters[last]->maximum);
+            }
+        } else if (x == maximum) {
+            maximum = generate_index(h, clusters[h]->maximum);
+        }
+    }
+
+    inline const Van_Emde_Boas* cluster_at(int h) const {
+        return (h >= 0 && h < (int)clusters.size()) ? clusters[h] : nullptr;
+    }
+
+    // Visits the keys in [lo, hi) in increasing order, without allocating.
+    // Only clusters the summary reports as non-empty are entered. The range is
+    // clipped to the universe first, so cluster offsets cannot overflow.
+    template <class Fn>
+    void for_each_in_range(int lo, int hi, Fn&& fn) const {
+        if (lo < 0) lo = 0;
+        if (hi > universe_size) hi = universe_size;
+        if (hi <= lo) return;
+        visit(lo, hi, 0, fn);
+    }
+
+    // Same, with the top-level clusters split across threads; fn(key, tid).
+    template <class Fn>
+    void parallel_for_each_in_range(int lo, int hi, int threads, Fn&& fn) const {
+        veb_parallel_for_each(*this, lo, hi, universe_size, cluster_span(), threads, fn);
+    }
+
+    // Keys per top-level cluster.
+    int cluster_span() const { return universe_size <= 2 ? universe_size : (int)ceil(sqrt((double)universe_size)); }
+
+    // Range-for over all keys, or over keys in [lo, hi), without building a vector.
+    using iterator = Veb_Key_Iterator<Van_Emde_Boas>;
+    iterator begin() const { return {this, minimum, INT_MAX}; }
+    iterator end() const { return {this, -1, INT_MAX}; }
+    Veb_Key_Range<Van_Emde_Boas> range(int lo, int hi) const {
+        int k = successor(lo - 1);
+        return {{this, (k >= hi) ? -1 : k, hi}};
+    }
+
+    // Lazy mode: make sure the cluster vector, clusters[h] and the summary exist.
+    void materialize(int h) {
+        int ru = (int)ceil(sqrt((double)universe_size));
+        if (clusters.empty()) clusters.assign(ru, nullptr);
+        if (!clusters[h]) clusters[h] = new_node<Van_Emde_Boas>(mem, ru, true, mem);
+        if (!summary) summary = new_node<Van_Emde_Boas>(mem, ru, true, mem);
+    }
+
+    // Appends all keys, in increasing order.
+    void enumerate(vector<int>& out) const {
+        for_each_in_range(0, universe_size, [&](int k) { out.push_back(k); });
+    }
+
+    // Adds the heap blocks of this subtree to r under part, and one node per
+    // level visited. The root (depth 0) is not a block of its own: it lives
+    // inside whatever owns the tree.
+    void memory_usage(Memory_Report& r, const string& part, int depth = 0) const {
+        size_t node = depth ? sizeof(*this) : 0, vec = clusters.capacity() * sizeof(Van_Emde_Boas*);
+        r.add_block(part, node);
+        r.add_block(part, vec);
+        r.add_level(depth, 1, sizeof(*this) + vec, heap_block_bytes(node) - node + heap_block_bytes(vec) - vec);
+        if (summary) summary->memory_usage(r, part, depth + 1);
+        for (auto* c : clusters) if (c) c->memory_usage(r, part, depth + 1);
+    }
+
+private:
+    // for_each_in_range on this node, whose key 0 is global key base.
+    template <class Fn>
+    void visit(int lo, int hi, int base, Fn& fn) const {
+        if (minimum == -1 || hi <= lo) return;
+        if (minimum >= lo && minimum < hi) fn(base + minimum);
+        if (universe_size <= 2) {
+            if (maximum != minimum && maximum >= lo && maximum < hi) fn(base + maximum);
+            return;
+        }
+        if (!summary) return;
+        int ru = (int)ceil(sqrt((double)universe_size));
+        int last = (hi - 1) / ru;
+        for (int h = summary->successor(std::max(lo, 0) / ru - 1); h != -1 && h <= last; h = summary->successor(h)) {
+            clusters[h]->visit(lo - h * ru, hi - h * ru, base + h * ru, fn);
+        }
+    }
+};
+
+// ------------------------ Power-of-two Van Emde Boas -------------------------
+// Same structure as Van_Emde_Boas, but U is rounded up to 2^k and every node
+// caches its split (upper/lower bit widths), so high/low/index are a shift and
+// a mask instead of a floating-point sqrt per call.
+class Van_Emde_Boas_Pow2 {
+public:
+    int universe_size;  // U = 2^(upper_bits + lower_bits)
+    int upper_bits;     // bits selecting the cluster (summary universe = 2^upper_bits)
+    int lower_bits;     // bits inside a cluster (cluster universe = 2^lower_bits)
+    int minimum;        // min key or -1 if empty
+    int maximum;        // max key or -1 if empty
+    Van_Emde_Boas_Pow2* summary;            // VEB(2^upper_bits)
+    pmr::vector<Van_Emde_Boas_Pow2*> clusters;  // 2^upper_bits clusters, each VEB(2^lower_bits)
+    bool lazy;                              // create summary/clusters on first insert
+    pmr::memory_resource* mem;              // where summary, clusters and the vector live
+
+    explicit Van_Emde_Boas_Pow2(int size, bool lazy_alloc = false, pmr::memory_resource* resource = nullptr)
+        : minimum(-1), maximum(-1), summary(nullptr), clusters(resource_or_default(resource)),
+          lazy(lazy_alloc), mem(resource_or_default(resource)) {
+        ARBOR_COUNT(veb_nodes_allocated, 1);
+        int bits = 1;
+        while ((1 << bits) < size) ++bits;
+        universe_size = 1 << bits;
+        upper_bits = (bits + 1) / 2;
+        lower_bits = bits / 2;
+        if (universe_size > 2 && !lazy) {
+            summary = new_node<Van_Emde_Boas_Pow2>(mem, 1 << upper_bits, false, mem);
+            clusters.assign(1 << upper_bits, nullptr);
+            for (auto& c : clusters) c = new_node<Van_Emde_Boas_Pow2>(mem, 1 << lower_bits, false, mem);
+        }
+    }
+
+    // Deep copy, into resource (null: the default).
+    Van_Emde_Boas_Pow2(const Van_Emde_Boas_Pow2& o, pmr::memory_resource* resource = nullptr)
+        : universe_size(o.universe_size), upper_bits(o.upper_bits), lower_bits(o.lower_bits),
+          minimum(o.minimum), maximum(o.maximum), summary(nullptr),
+          clusters(o.clusters.size(), nullptr, resource_or_default(resource)), lazy(o.lazy),
+          mem(resource_or_default(resource)) {
+        ARBOR_COUNT(veb_nodes_allocated, 1);
+        if (o.summary) summary = new_node<Van_Emde_Boas_Pow2>(mem, *o.summary, mem);
+        for (size_t i = 0; i < clusters.size(); ++i) if (o.clusters[i]) clusters[i] = new_node<Van_Emde_Boas_Pow2>(mem, *o.clusters[i], mem);
+    }
+    Van_Emde_Boas_Pow2& operator=(const Van_Emde_Boas_Pow2&) = delete;
+
+    ~Van_Emde_Boas_Pow2() {
+        delete_node(mem, summary);
+        for (auto* c : clusters) delete_node(mem, c);
+    }
+
+    inline int high(int x) const { return x >> lower_bits; }
+    inline int low(int x)  const { return x & ((1 << lower_bits) - 1); }
+    inline int generate_index(int x, int y) const { return (x << lower_bits) | y; }
+
+    inline bool empty() const { return minimum == -1; }
+
+    void empty_insert(int x) { minimum = maximum = x; }
+
+    bool contains(int x) const {
+        if (x == minimum || x == maximum) return true;
+        if (universe_size <= 2) return false;
+        int h = high(x);
+        if (h < 0 || h >= (int)clusters.size()) return false;
+        if (!clusters[h] || clusters[h]->empty()) return false;
+        return clusters[h]->contains(low(x));
+    }
+
+    void insert(int x) {
+        ARBOR_COUNT(veb_insert_levels, 1);
+        if (minimum == -1) { empty_insert(x); return; }
+        if (x == minimum || x == maximum) return;  // already present
+        if (x < minimum) std::swap(x, minimum);
+
+        if (universe_size > 2) {
+            int h = high(x);
+            int l = low(x);
+            if (lazy) materialize(h);
+            if (clusters[h]->minimum == -1) {
+                summary->insert(h);
+                clusters[h]->empty_insert(l);
+            } else {
+                clusters[h]->insert(l);
+            }
+        }
+        if (x > maximum) maximum = x;
+    }
+
+    // Bulk insert of sorted keys (see veb_insert_sorted).
+    void insert_sorted(const int* keys, size_t n) { veb_insert_sorted(*this, keys, n); }
+
+    // Same bottom-up fill as Van_Emde_Boas::fill_sorted.
+    void fill_sorted(int* keys, size_t n, int* tmp) {
+        ARBOR_COUNT(veb_insert_levels, 1);
+        minimum = keys[0];
+        maximum = keys[n - 1];
+        if (universe_size <= 2 || n == 1) return;
+        size_t m = 0;
+        for (size_t a = 1; a < n;) {
+            int h = high(keys[a]);
+            size_t b = a;
+            for (; b < n && high(keys[b]) == h; ++b) keys[b] = low(keys[b]);
+            if (lazy) materialize(h);
+            clusters[h]->fill_sorted(keys + a, b - a, tmp + a);
+            tmp[m++] = h;
+            a = b;
+        }
+        summary->fill_sorted(tmp, m, keys);
+    }
+
+    // ---- ordered-set API (all O(log log U); -1 means "none") ----
+    inline int min() const { return minimum; }
+    inline int max() const { return maximum; }
+
+    // Smallest key > x. x may be -1 (returns min()).
+    int successor(int x) const {
+        if (minimum == -1) return -1;
+        if (x < minimum) return minimum;
+        if (universe_size <= 2) return (x < maximum) ? maximum : -1;
+        int h = high(x), l = low(x);
+        const Van_Emde_Boas_Pow2* c = cluster_at(h);
+        if (c && !c->empty() && l < c->maximum) return generate_index(h, c->successor(l));
+        int next = summary ? summary->successor(h) : -1;
+        if (next == -1) return -1;
+        return generate_index(next, clusters[next]->minimum);
+    }
+
+    // Largest key < x.
+    int predecessor(int x) const {
+        if (minimum == -1 || x <= minimum) return -1;
+        if (x > maximum) return maximum;
+        if (universe_size <= 2) return minimum;
+        int h = high(x), l = low(x);
+        const Van_Emde_Boas_Pow2* c = cluster_at(h);
+        if (c && !c->empty() && l > c->minimum) return generate_index(h, c->predecessor(l));
+        int prev = summary ? summary->predecessor(h) : -1;
+        if (prev == -1) return minimum;
+        return generate_index(prev, clusters[prev]->maximum);
+    }
+
+    // Removes x; returns false if it was not present.
+    bool erase(int x) {
+        if (!contains(x)) return false;
+        erase_present(x);
+        return true;
+    }
+
+    void erase_present(int x) {
+        if (minimum == maximum) { minimum = maximum = -1; return; }
+        if (universe_size <= 2) { minimum = maximum = (x == minimum) ? maximum : minimum; return; }
+        if (x == minimum) {
+            // Pull the next key out of the clusters to become the new min.
+            int first = summary->minimum;
+            x = generate_index(first, clusters[first]->minimum);
+            minimum = x;
+        }
+        int h = high(x);
+        clusters[h]->erase_present(low(x));
+        if (clusters[h]->empty()) {
+            summary->erase_present(h);
+            if (x == maximum) {
+                int last = summary->maximum;
+                maximum = (last == -1) ? minimum : generate_index(last, clusters[last]->maximum);
+            }
+        } else if (x == maximum) {
+            maximum = generate_index(h, clusters[h]->maximum);
+        }
+    }
+
+    inline const Van_Emde_Boas_Pow2* cluster_at(int h) const {
+        return (h >= 0 && h < (int)clusters.size()) ? clusters[h] : nullptr;
+    }
+
+    // Visits the keys in [lo, hi) in increasing order, without allocating
+    // (clipped to the universe, as in Van_Emde_Boas).
+    template <class Fn>
+    void for_each_in_range(int lo, int hi, Fn&& fn) const {
+        if (lo < 0) lo = 0;
+        if (hi > universe_size) hi = universe_size;
+        if (hi <= lo) return;
+        visit(lo, hi, 0, fn);
+    }
+
+    // Same, with the top-level clusters split across threads; fn(key, tid).
+    template <class Fn>
+    void parallel_for_each_in_range(int lo, int hi, int threads, Fn&& fn) const {
+        veb_parallel_for_each(*this, lo, hi, universe_size, cluster_span(), threads, fn);
+    }
+
+    // Keys per top-level cluster.
+    int cluster_span() const { return universe_size <= 2 ? universe_size : 1 << lower_bits; }
+
+    // Range-for over all keys, or over keys in [lo, hi), without building a vector.
+    using iterator = Veb_Key_Iterator<Van_Emde_Boas_Pow2>;
+    iterator begin() const { return {this, minimum, INT_MAX}; }
+    iterator end() const { return {this, -1, INT_MAX}; }
+    Veb_Key_Range<Van_Emde_Boas_Pow2> range(int lo, int hi) const {
+        int k = successor(lo - 1);
+        return {{this, (k >= hi) ? -1 : k, hi}};
+    }
+
+    void materialize(int h) {
+        if (clusters.empty()) clusters.assign(1 << upper_bits, nullptr);
+        if (!clusters[h]) clusters[h] = new_node<Van_Emde_Boas_Pow2>(mem, 1 << lower_bits, true, mem);
+        if (!summary) summary = new_node<Van_Emde_Boas_Pow2>(mem, 1 << upper_bits, true, mem);
+    }
+
+    void enumerate(vector<int>& out) const {
+        for_each_in_range(0, universe_size, [&](int k) { out.push_back(k); });
+    }
+
+    // See Van_Emde_Boas::memory_usage.
+    void memory_usage(Memory_Report& r, const string& part, int depth = 0) const {
+        size_t node = depth ? sizeof(*this) : 0, vec = clusters.capacity() * sizeof(Van_Emde_Boas_Pow2*);
+        r.add_block(part, node);
+        r.add_block(part, vec);
+        r.add_level(depth, 1, sizeof(*this) + vec, heap_block_bytes(node) - node + heap_block_bytes(vec) - vec);
+        if (summary) summary->memory_usage(r, part, depth + 1);
+        for (auto* c : clusters) if (c) c->memory_usage(r, part, depth + 1);
+    }
+
+private:
+    template <class Fn>
+    void visit(int lo, int hi, int base, Fn& fn) const {
+        if (minimum == -1 || hi <= lo) return;
+        if (minimum >= lo && minimum < hi) fn(base + minimum);
+        if (universe_size <= 2) {
+            if (maximum != minimum && maximum >= lo && maximum < hi) fn(base + maximum);
+            return;
+        }
+        if (!summary) return;
+        int last = high(hi - 1);
+        for (int h = summary->successor(high(std::max(lo, 0)) - 1); h != -1 && h <= last; h = summary->successor(h)) {
+            int off = h << lower_bits;
+            clusters[h]->visit(lo - off, hi - off, base + off, fn);
+        }
+    }
+};
+
+// --------------------------- Flat (arena) Van Emde Boas -----------------------
+// Pointer-free layout: every node lives in one contiguous vector and refers to
+// its summary and clusters by index (the clusters of a node are adjacent, so
+// cluster h is first_cluster + h). Universes of <= 64 keys are leaves stored
+// as a single 64-bit bitmap. The arena is sized exactly once in the
+// constructor, so a tree is one allocation and teardown is one free.
+class Flat_Van_Emde_Boas {
+public:
+    struct Node {
+        int32_t  minimum;        // interior: min key or -1 if empty
+        int32_t  maximum;        // interior: max key or -1 if empty
+        uint32_t summary;        // interior: index of summary node
+        uint32_t first_cluster;  // interior: index of cluster 0
+        uint64_t bits;           // leaf: membership bitmap
+        uint8_t  log_u;          // universe = 2^log_u
+        uint8_t  lower_bits;     // interior: bits inside a cluster
+    };
+
+    static constexpr int LEAF_BITS = 6;   // 2^6 = 64 keys per leaf word
+
+    int universe_size;        // U = 2^k (rounded up)
+    pmr::vector<Node> nodes;  // nodes[0] is the root
+
+    explicit Flat_Van_Emde_Boas(int size, pmr::memory_resource* resource = nullptr)
+        : nodes(resource_or_default(resource)) {
+        int bits = 0;
+        while ((1 << bits) < size) ++bits;
+        universe_size = 1 << bits;
+        nodes.resize(count_nodes(bits));
+        uint32_t next = 1;
+        build(0, bits, next);
+        ARBOR_COUNT(veb_nodes_allocated, nodes.size());
+    }
+
+    // Copy into resource (the plain copy, like any pmr container, uses the default).
+    Flat_Van_Emde_Boas(const Flat_Van_Emde_Boas& o, pmr::memory_resource* resource)
+        : universe_size(o.universe_size), nodes(o.nodes, resource_or_default(resource)) {}
+
+    inline bool empty() const { return node_empty(0); }
+    inline int min() const { return node_min(0); }
+    inline int max() const { return node_max(0); }
+
+    bool contains(int x) const {
+        if (x < 0 || x >= universe_size) return false;
+        return contains_at(0, x);
+    }
+    void insert(int x) { insert_at(0, x); }
+    // Bulk insert of sorted keys (see veb_insert_sorted).
+    void insert_sorted(const int* keys, size_t n) { veb_insert_sorted(*this, keys, n); }
+    void fill_sorted(int* keys, size_t n, int* tmp) { fill_at(0, keys, n, tmp); }
+    bool erase(int x) {
+        if (!contains(x)) return false;
+        erase_at(0, x);
+        return true;
+    }
+    int successor(int x) const {
+        if (x >= universe_size) return -1;
+        return successor_at(0, x < -1 ? -1 : x);
+    }
+    int predecessor(int x) const {
+        if (x <= 0) return -1;
+        return predecessor_at(0, x > universe_size ? universe_size : x);
+    }
+
+    void enumerate(vector<int>& out) const {
+        for_each_in_range(0, universe_size, [&](int k) { out.push_back(k); });
+    }
+
+    // Visits the keys in [lo, hi) in increasing order, without allocating.
+    // The range is clipped to the universe first: a cluster number past the
+    // summary's would index past the arena.
+    template <class Fn>
+    void for_each_in_range(int lo, int hi, Fn&& fn) const {
+        if (lo < 0) lo = 0;
+        if (hi > universe_size) hi = universe_size;
+        if (hi <= lo) return;
+        visit_at(0, lo, hi, 0, fn);
+    }
+
+    // Same, with the top-level clusters split across threads; fn(key, tid).
+    template <class Fn>
+    void parallel_for_each_in_range(int lo, int hi, int threads, Fn&& fn) const {
+        veb_parallel_for_each(*this, lo, hi, universe_size, cluster_span(), threads, fn);
+    }
+
+    // Keys per top-level cluster (the whole universe when the root is a leaf).
+    int cluster_span() const { return is_leaf(0) ? universe_size : 1 << nodes[0].lower_bits; }
+
+    using iterator = Veb_Key_Iterator<Flat_Van_Emde_Boas>;
+    iterator begin() const { return {this, min(), INT_MAX}; }
+    iterator end() const { return {this, -1, INT_MAX}; }
+    Veb_Key_Range<Flat_Van_Emde_Boas> range(int lo, int hi) const {
+        int k = successor(lo - 1);
+        return {{this, (k >= hi) ? -1 : k, hi}};
+    }
+
+    size_t arena_bytes() const { return nodes.size() * sizeof(Node); }
+
+    // The arena is one block; levels are counted from the shape, not by walking.
+    void memory_usage(Memory_Report& r, const string& part, int depth = 0) const {
+        r.add_vector(part, nodes);
+        add_levels(r, nodes.empty() ? 0 : nodes[0].log_u, depth, 1);
+    }
+
+private:
+    static void add_levels(Memory_Report& r, int log_u, int depth, size_t count) {
+        r.add_level(depth, count, count * sizeof(Node), 0);
+        if (log_u <= LEAF_BITS) return;
+        int up = (log_u + 1) / 2, lo = log_u / 2;
+        add_levels(r, up, depth + 1, count);
+        add_levels(r, lo, depth + 1, count << up);
+    }
+
+    static size_t count_nodes(int log_u) {
+        if (log_u <= LEAF_BITS) return 1;
+        int up = (log_u + 1) / 2, lo = log_u / 2;
+        return 1 + count_nodes(up) + ((size_t)1 << up) * count_nodes(lo);
+    }
+
+    void build(uint32_t at, int log_u, uint32_t& next) {
+        Node& nd = nodes[at];
+        nd.minimum = nd.maximum = -1;
+        nd.summary = nd.first_cluster = 0;
+        nd.bits = 0;
+        nd.log_u = (uint8_t)log_u;
+        nd.lower_bits = 0;
+        if (log_u <= LEAF_BITS) return;
+        int up = (log_u + 1) / 2, lo = log_u / 2;
+        nd.lower_bits = (uint8_t)lo;
+        nd.summary = next++;
+        build(nd.summary, up, next);
+        nd.first_cluster = next;
+        next += 1u << up;
+        for (uint32_t h = 0; h < (1u << up); ++h) build(nodes[at].first_cluster + h, lo, next);
+    }
+
+    inline bool is_leaf(uint32_t n) const { return nodes[n].log_u <= LEAF_BITS; }
+    inline bool node_empty(uint32_t n) const {
+        return is_leaf(n) ? nodes[n].bits == 0 : nodes[n].minimum == -1;
+    }
+    inline int node_min(uint32_t n) const {
+        if (!is_leaf(n)) return nodes[n].minimum;
+        return nodes[n].bits ? __builtin_ctzll(nodes[n].bits) : -1;
+    }
+    inline int node_max(uint32_t n) const {
+        if (!is_leaf(n)) return nodes[n].maximum;
+        return nodes[n].bits ? 63 - __builtin_clzll(nodes[n].bits) : -1;
+    }
+
+    bool contains_at(uint32_t n, int x) const {
+        for (;;) {
+            const Node& nd = nodes[n];
+            if (nd.log_u <= LEAF_BITS) return (nd.bits >> x) & 1;
+            if (x == nd.minimum || x == nd.maximum) return true;
+            if (nd.minimum == -1) return false;
+            n = nd.first_cluster + (x >> nd.lower_bits);
+            x &= (1 << nd.lower_bits) - 1;
+        }
+    }
+
+    void insert_at(uint32_t n, int x) {
+        ARBOR_COUNT(veb_insert_levels, 1);
+        Node& nd = nodes[n];
+        if (nd.log_u <= LEAF_BITS) { nd.bits |= 1ULL << x; return; }
+        if (nd.minimum == -1) { nd.minimum = nd.maximum = x; return; }
+        if (x == nd.minimum || x == nd.maximum) return;
+        if (x < nd.minimum) std::swap(x, nd.minimum);
+        int h = x >> nd.lower_bits, l = x & ((1 << nd.lower_bits) - 1);
+        uint32_t c = nd.first_cluster + h;
+        if (node_empty(c)) insert_at(nd.summary, h);
+        insert_at(c, l);  // O(1) when c was empty
+        if (x > nd.maximum) nd.maximum = x;
+    }
+
+    // Bottom-up fill of an empty node (see Van_Emde_Boas::fill_sorted); a leaf
+    // ORs its keys into the word.
+    void fill_at(uint32_t n, int* keys, size_t cnt, int* tmp) {
+        ARBOR_COUNT(veb_insert_levels, 1);
+        Node& nd = nodes[n];
+        if (nd.log_u <= LEAF_BITS) {
+            uint64_t b = 0;
+            for (size_t i = 0; i < cnt; ++i) b |= 1ULL << keys[i];
+            nd.bits = b;
+            return;
+        }
+        nd.minimum = keys[0];
+        nd.maximum = keys[cnt - 1];
+        if (cnt == 1) return;
+        int lb = nd.lower_bits, mask = (1 << lb) - 1;
+        size_t m = 0;
+        for (size_t a = 1; a < cnt;) {
+            int h = keys[a] >> lb;
+            size_t b = a;
+            for (; b < cnt && (keys[b] >> lb) == h; ++b) keys[b] &= mask;
+            fill_at(nd.first_cluster + h, keys + a, b - a, tmp + a);
+            tmp[m++] = h;
+            a = b;
+        }
+        fill_at(nd.summary, tmp, m, keys);
+    }
+
+    void erase_at(uint32_t n, int x) {
+        Node& nd = nodes[n];
+        if (nd.log_u <= LEAF_BITS) { nd.bits &= ~(1ULL << x); return; }
+        if (nd.minimum == nd.maximum) { nd.minimum = nd.maximum = -1; return; }
+        int lb = nd.lower_bits;
+        if (x == nd.minimum) {
+            int first = node_min(nd.summary);
+            x = (first << lb) | node_min(nd.first_cluster + first);
+            nd.minimum = x;
+        }
+        int h = x >> lb;
+        uint32_t c = nd.first_cluster + h;
+        erase_at(c, x & ((1 << lb) - 1));
+        if (node_empty(c)) {
+            erase_at(nd.summary, h);
+            if (x == nd.maximum) {
+                int last = node_max(nd.summary);
+                nd.maximum = (last == -1) ? nd.minimum : (last << lb) | node_max(nd.first_cluster + last);
+            }
+        } else if (x == nd.maximum) {
+            nd.maximum = (h << lb) | node_max(c);
+        }
+    }
+
+    template <class Fn>
+    void visit_at(uint32_t n, int lo, int hi, int base, Fn& fn) const {
+        const Node& nd = nodes[n];
+        lo = std::max(lo, 0);
+        if (nd.log_u <= LEAF_BITS) {
+            hi = std::min(hi, 64);
+            if (hi <= lo) return;
+            uint64_t m = nd.bits & (~0ULL << lo) & (hi == 64 ? ~0ULL : (1ULL << hi) - 1);
+            for (; m; m &= m - 1) fn(base + __builtin_ctzll(m));
+            return;
+        }
+        if (nd.minimum == -1 || hi <= lo) return;
+        if (nd.minimum >= lo && nd.minimum < hi) fn(base + nd.minimum);
+        int lb = nd.lower_bits, last = (hi - 1) >> lb;
+        for (int h = successor_at(nd.summary, (lo >> lb) - 1); h != -1 && h <= last; h = successor_at(nd.summary, h)) {
+            int off = h << lb;
+            visit_at(nd.first_cluster + h, lo - off, hi - off, base + off, fn);
+        }
+    }
+
+    int successor_at(uint32_t n, int x) const {
+        const Node& nd = nodes[n];
+        if (nd.log_u <= LEAF_BITS) {
+            if (x >= 63) return -1;
+            uint64_t m = nd.bits & (~0ULL << (x + 1));
+            return m ? __builtin_ctzll(m) : -1;
+        }
+        if (nd.minimum == -1) return -1;
+        if (x < nd.minimum) return nd.minimum;
+        int lb = nd.lower_bits;
+        int h = x >> lb, l = x & ((1 << lb) - 1);
+        uint32_t c = nd.first_cluster + h;
+        if (!node_empty(c) && l < node_max(c)) return (h << lb) | successor_at(c, l);
+        int next = successor_at(nd.summary, h);
+        if (next == -1) return -1;
+        return (next << lb) | node_min(nd.first_cluster + next);
+    }
+
+    int predecessor_at(uint32_t n, int x) const {
+        const Node& nd = nodes[n];
+        if (nd.log_u <= LEAF_BITS) {
+            if (x <= 0) return -1;
+            uint64_t m = nd.bits & ((x >= 64) ? ~0ULL : ((1ULL << x) - 1));
+            return m ? 63 - __builtin_clzll(m) : -1;
+        }
+        if (nd.minimum == -1 || x <= nd.minimum) return -1;
+        if (x > nd.maximum) return nd.maximum;
+        int lb = nd.lower_bits;
+        int h = x >> lb, l = x & ((1 << lb) - 1);
+        uint32_t c = nd.first_cluster + h;
+        if (!node_empty(c) && l > node_min(c)) return (h << lb) | predecessor_at(c, l);
+        int prev = predecessor_at(nd.summary, h);
+        if (prev == -1) return nd.minimum;
+        return (prev << lb) | node_max(nd.first_cluster + prev);
+    }
+};
+
+// ------------------------ Compile-time Van Emde Boas -------------------------
+// VEB over a fixed universe of 2^LogU keys, with the recursion unrolled by
+// the template: a node holds its summary and 2^upper clusters inline (no heap,
+// no pointers), and universes of <= 64 keys are a single uint64_t whose
+// min/successor are tzcnt/lzcnt. Same interface as Van_Emde_Boas; construction
+// is constexpr. The footprint is fixed (2^8 -> 144 B, 2^16 -> ~37 KB, 2^20 -> ~280 KB).
+template <unsigned LogU, bool Leaf = (LogU <= 6)>
+class Static_Van_Emde_Boas;
+
+template <unsigned LogU>
+class Static_Van_Emde_Boas<LogU, true> {
+public:
+    static constexpr int universe_size = 1 << LogU;
+
+    constexpr Static_Van_Emde_Boas() = default;
+
+    constexpr bool empty() const { return bits == 0; }
+    constexpr int min() const { return bits ? __builtin_ctzll(bits) : -1; }
+    constexpr int max() const { return bits ? 63 - __builtin_clzll(bits) : -1; }
+    constexpr bool contains(int x) const { return x >= 0 && x < universe_size && ((bits >> x) & 1); }
+    constexpr void insert(int x) { bits |= 1ULL << x; }
+    void insert_sorted(const int* keys, size_t n) { veb_insert_sorted(*this, keys, n); }
+    constexpr void fill_sorted(int* keys, size_t n, int*) {
+        for (size_t i = 0; i < n; ++i) bits |= 1ULL << keys[i];
+    }
+    constexpr bool erase(int x) {
+        if (!contains(x)) return false;
+        bits &= ~(1ULL << x);
+        return true;
+    }
+    constexpr int successor(int x) const {
+        if (x >= universe_size - 1) return -1;
+        uint64_t m = x < 0 ? bits : bits & (~0ULL << (x + 1));
+        return m ? __builtin_ctzll(m) : -1;
+    }
+    constexpr int predecessor(int x) const {
+        if (x <= 0) return -1;
+        uint64_t m = x >= 64 ? bits : bits & ((1ULL << x) - 1);
+        return m ? 63 - __builtin_clzll(m) : -1;
+    }
+
+    template <class Fn>
+    constexpr void for_each(Fn&& fn) const {
+        for (uint64_t m = bits; m; m &= m - 1) fn(__builtin_ctzll(m));
+    }
+    template <class Fn>
+    constexpr void for_each_in_range(int lo, int hi, Fn&& fn) const {
+        if (lo < 0) lo = 0;
+        if (hi > 64) hi = 64;
+        if (hi <= lo) return;
+        uint64_t m = bits & (~0ULL << lo) & (hi == 64 ? ~0ULL : (1ULL << hi) - 1);
+        for (; m; m &= m - 1) fn(__builtin_ctzll(m));
+    }
+    template <class Fn>
+    void parallel_for_each_in_range(int lo, int hi, int threads, Fn&& fn) const {
+        veb_parallel_for_each(*this, lo, hi, universe_size, cluster_span(), threads, fn);
+    }
+    static constexpr int cluster_span() { return universe_size; }
+
+    // Inline storage: no heap blocks, only the per-level shape.
+    void memory_usage(Memory_Report& r, const string&, int depth = 0) const { add_levels(r, depth, 1); }
+    static void add_levels(Memory_Report& r, int depth, size_t count) {
+        r.add_level(depth, count, count * sizeof(Static_Van_Emde_Boas), 0);
+    }
+    void enumerate(vector<int>& out) const { for_each([&](int k) { out.push_back(k); }); }
+
+    using iterator = Veb_Key_Iterator<Static_Van_Emde_Boas>;
+    iterator begin() const { return {this, min(), INT_MAX}; }
+    iterator end() const { return {this, -1, INT_MAX}; }
+    Veb_Key_Range<Static_Van_Emde_Boas> range(int lo, int hi) const {
+        int k = successor(lo - 1);
+        return {{this, (k >= hi) ? -1 : k, hi}};
+    }
+
+private:
+    uint64_t bits = 0;
+};
+
+template <unsigned LogU>
+class Static_Van_Emde_Boas<LogU, false> {
+    static constexpr unsigned UPPER = (LogU + 1) / 2;   // cluster-selecting bits
+    static constexpr unsigned LOWER = LogU / 2;         // bits inside a cluster
+
+public:
+    static constexpr int universe_size = 1 << LogU;
+
+    constexpr Static_Van_Emde_Boas() = default;
+
+    constexpr bool empty() const { return minimum == -1; }
+    constexpr int min() const { return minimum; }
+    constexpr int max() const { return maximum; }
+
+    constexpr bool contains(int x) const {
+        if (x < 0 || x >= universe_size) return false;
+        if (x == minimum || x == maximum) return true;
+        return clusters[high(x)].contains(low(x));
+    }
+
+    constexpr void insert(int x) {
+        if (minimum == -1) { minimum = maximum = x; return; }
+        if (x == minimum || x == maximum) return;  // already present
+        if (x < minimum) { int t = x; x = minimum; minimum = t; }
+        int h = high(x);
+        if (clusters[h].empty()) summary.insert(h);
+        clusters[h].insert(low(x));
+        if (x > maximum) maximum = x;
+    }
+
+    // Bulk insert of sorted keys (see veb_insert_sorted and
+    // Van_Emde_Boas::fill_sorted).
+    void insert_sorted(const int* keys, size_t n) { veb_insert_sorted(*this, keys, n); }
+    constexpr void fill_sorted(int* keys, size_t n, int* tmp) {
+        minimum = keys[0];
+        maximum = keys[n - 1];
+        size_t m = 0;
+        for (size_t a = 1; a < n;) {
+            int h = high(keys[a]);
+            size_t b = a;
+            for (; b < n && high(keys[b]) == h; ++b) keys[b] = low(keys[b]);
+            clusters[h].fill_sorted(keys + a, b - a, tmp + a);
+            tmp[m++] = h;
+            a = b;
+        }
+        if (m) summary.fill_sorted(tmp, m, keys);
+    }
+
+    constexpr bool erase(int x) {
+        if (!contains(x)) return false;
+        erase_present(x);
+        return true;
+    }
+
+    constexpr int successor(int x) const {
+        if (minimum != -1 && x < minimum) return minimum;
+        if (minimum == -1 || x >= maximum) return -1;
+        int h = high(x), l = low(x);
+        int cmax = clusters[h].max();
+        if (cmax != -1 && l < cmax) return index(h, clusters[h].successor(l));
+        int next = summary.successor(h);
+        return next == -1 ? -1 : index(next, clusters[next].min());
+    }
+
+    constexpr int predecessor(int x) const {
+        if (minimum == -1 || x <= minimum) return -1;
+        if (x > maximum) return maximum;
+        int h = high(x), l = low(x);
+        int cmin = clusters[h].min();
+        if (cmin != -1 && l > cmin) return index(h, clusters[h].predecessor(l));
+        int prev = summary.predecessor(h);
+        return prev == -1 ? minimum : index(prev, clusters[prev].max());
+    }
+
+    // Visits every key in increasing order.
+    template <class Fn>
+    constexpr void for_each(Fn&& fn) const {
+        if (minimum == -1) return;
+        fn(minimum);
+        summary.for_each([&](int h) { clusters[h].for_each([&](int l) { fn(index(h, l)); }); });
+    }
+
+    // Keys in [lo, hi), in increasing order; the summary picks the clusters.
+    template <class Fn>
+    constexpr void for_each_in_range(int lo, int hi, Fn&& fn) const {
+        if (lo < 0) lo = 0;
+        if (hi > universe_size) hi = universe_size;
+        if (minimum == -1 || hi <= lo) return;
+        if (minimum >= lo && minimum < hi) fn(minimum);
+        summary.for_each_in_range(high(lo), high(hi - 1) + 1, [&](int h) {
+            int off = index(h, 0);
+            clusters[h].for_each_in_range(lo - off, hi - off, [&](int l) { fn(off | l); });
+        });
+    }
+
+    // Same, with the top-level clusters split across threads; fn(key, tid).
+    template <class Fn>
+    void parallel_for_each_in_range(int lo, int hi, int threads, Fn&& fn) const {
+        veb_parallel_for_each(*this, lo, hi, universe_size, cluster_span(), threads, fn);
+    }
+    static constexpr int cluster_span() { return 1 << LOWER; }
+
+    void memory_usage(Memory_Report& r, const string&, int depth = 0) const { add_levels(r, depth, 1); }
+    // count nodes of this shape at depth; a node's own bytes are min/max.
+    static void add_levels(Memory_Report& r, int depth, size_t count) {
+        r.add_level(depth, count, count * (sizeof(Static_Van_Emde_Boas) - sizeof(summary) - sizeof(clusters)), 0);
+        Static_Van_Emde_Boas<UPPER>::add_levels(r, depth + 1, count);
+        Static_Van_Emde_Boas<LOWER>::add_levels(r, depth + 1, count << UPPER);
+    }
+    void enumerate(vector<int>& out) const { for_each([&](int k) { out.push_back(k); }); }
+
+    using iterator = Veb_Key_Iterator<Static_Van_Emde_Boas>;
+    iterator begin() const { return {this, min(), INT_MAX}; }
+    iterator end() const { return {this, -1, INT_MAX}; }
+    Veb_Key_Range<Static_Van_Emde_Boas> range(int lo, int hi) const {
+        int k = successor(lo - 1);
+        return {{this, (k >= hi) ? -1 : k, hi}};
+    }
+
+private:
+    int minimum = -1;   // not stored in a cluster
+    int maximum = -1;
+    Static_Van_Emde_Boas<UPPER> summary;
+    Static_Van_Emde_Boas<LOWER> clusters[1 << UPPER];
+
+    static constexpr int high(int x) { return x >> LOWER; }
+    static constexpr int low(int x) { return x & ((1 << LOWER) - 1); }
+    static constexpr int index(int h, int l) { return (h << LOWER) | l; }
+
+    constexpr void erase_present(int x) {
+        if (minimum == maximum) { minimum = maximum = -1; return; }
+        if (x == minimum) {  // promote the smallest clustered key
+            int first = summary.min();
+            x = index(first, clusters[first].min());
+            minimum = x;
+        }
+        int h = high(x);
+        clusters[h].erase(low(x));
+        if (clusters[h].empty()) {
+            summary.erase(h);
+            if (x == maximum) {
+                int last = summary.max();
+                maximum = last == -1 ? minimum : index(last, clusters[last].max());
+            }
+        } else if (x == maximum) {
+            maximum = index(h, clusters[h].max());
+        }
+    }
+};
+
+// ------------------------------ Label interning -------------------------------
+// Every label is stored once, back to back, in a single arena; offsets[id] ..
+// offsets[id+1] delimits label id. Lookup is an open-addressing (linear probing)
+// table of (id, hash) slots keyed by string_view, so neither the table nor the
+// labels allocate per entry.
+class Label_Interner {
+public:
+    struct Slot {
+        int32_t id;     // -1 if empty
+        uint32_t hash;  // cached so probes and rehashes rarely touch the arena
+    };
+
+    pmr::string arena;              // all label bytes
+    pmr::vector<uint64_t> offsets;  // n+1 prefix offsets into arena
+    pmr::vector<Slot> slots;        // power-of-two table, load factor <= 0.75
+
+    explicit Label_Interner(pmr::memory_resource* mem = nullptr)
+        : arena(resource_or_default(mem)), offsets(1, 0, resource_or_default(mem)),
+          slots(16, Slot{-1, 0}, resource_or_default(mem)) {}
+
+    static inline uint32_t hash_of(string_view sv) {
+        uint64_t h = 1469598103934665603ULL;  // FNV-1a
+        for (unsigned char c : sv) { h ^= c; h *= 1099511628211ULL; }
+        return (uint32_t)(h ^ (h >> 32));
+    }
+
+    inline int size() const { return (int)offsets.size() - 1; }
+
+    inline string_view view(int id) const {
+        return string_view(arena.data() + offsets[id], (size_t)(offsets[id + 1] - offsets[id]));
+    }
+
+    // True if sv points into the arena (a view() or a piece of one), which the
+    // next append() may reallocate.
+    inline bool in_arena(string_view sv) const {
+        const char* b = arena.data();
+        return less_equal<const char*>()(b, sv.data()) && less<const char*>()(sv.data(), b + arena.size());
+    }
+
+    int find(string_view sv) const { return find(sv, hash_of(sv)); }
+
+    int find(string_view sv, uint32_t h) const {
+        return probe(slots.data(), slots.size(), arena.data(), offsets.data(), sv, h);
+    }
+
+    // Lookup over raw tables; also used on a memory-mapped snapshot.
+    static int probe(const Slot* table, size_t table_size, const char* bytes, const uint64_t* offs,
+                     string_view sv, uint32_t h) {
+        ARBOR_COUNT(label_lookups, 1);
+        size_t mask = table_size - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            ARBOR_COUNT(label_probes, 1);
+            const Slot& sl = table[i];
+            if (sl.id == -1) return -1;
+            if (sl.hash == h && offs[sl.id + 1] - offs[sl.id] == sv.size() &&
+                memcmp(bytes + offs[sl.id], sv.data(), sv.size()) == 0) return sl.id;
+        }
+    }
+
+    // Returns (id, inserted).
+    pair<int,bool> intern(string_view sv) {
+        uint32_t h = hash_of(sv);
+        int id = find(sv, h);
+        if (id != -1) return {id, false};
+        return {append(sv, h), true};
+    }
+
+    // Adds a label known to be absent; the caller supplies its hash_of().
+    int append(string_view sv, uint32_t h) {
+        int id = size();
+        if ((size_t)(id + 1) * 4 > slots.size() * 3) rehash(slots.size() * 2);
+        arena.append(sv.data(), sv.size());
+        offsets.push_back(arena.size());
+        place(id, h);
+        return id;
+    }
+
+    // label_of() storage (arena + offsets) and the id_of() hash table.
+    void memory_usage(Memory_Report& r) const {
+        if (arena.capacity() > string().capacity()) r.add_block("labels.arena", arena.capacity() + 1);
+        r.add_vector("labels.offsets", offsets);
+        r.add_vector("labels.table", slots);
+    }
+
+    void reserve(size_t n, size_t bytes = 0) {
+        offsets.reserve(n + 1);
+        if (bytes) arena.reserve(bytes);
+        size_t cap = slots.size();
+        while (n * 4 > cap * 3) cap *= 2;
+        if (cap != slots.size()) rehash(cap);
+    }
+
+private:
+    void place(int id, uint32_t h) {
+        size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        while (slots[i].id != -1) i = (i + 1) & mask;
+        slots[i] = Slot{id, h};
+    }
+
+    void rehash(size_t cap) {
+        pmr::vector<Slot> old(cap, Slot{-1, 0}, slots.get_allocator());
+        old.swap(slots);
+        for (const Slot& sl : old) if (sl.id != -1) place(sl.id, sl.hash);
+    }
+};
+
+// ------------------------------ ID index backends -----------------------------
+// Non-owning reference to a void(int) callable, so the virtual scans below can
+// take a lambda without std::function (and its possible allocation).
+struct Key_Visitor {
+    void* ctx;
+    void (*call)(void*, int);
+
+    template <class Fn, class = enable_if_t<!is_same<decay_t<Fn>, Key_Visitor>::value>>
+    Key_Visitor(Fn& fn)
+        : ctx(const_cast<void*>(static_cast<const void*>(&fn))),
+          call([](void* c, int k) { (*static_cast<Fn*>(c))(k); }) {}
+    void operator()(int k) const { call(ctx, k); }
+};
+
+// Arbor keeps its concept IDs in an Id_Index so the backing structure can be
+// chosen per deployment (see Index_Kind / make_id_index). All backends answer
+// the same ordered-set queries; -1 means "none".
+class Id_Index {
+public:
+    virtual ~Id_Index() = default;
+    virtual const char* name() const = 0;
+    virtual int universe() const = 0;            // keys must lie in [0, universe())
+    virtual void insert(int x) = 0;
+    virtual bool contains(int x) const = 0;
+    virtual bool erase(int x) = 0;
+    virtual int successor(int x) const = 0;      // smallest key > x (x may be -1)
+    virtual int predecessor(int x) const = 0;    // largest key < x
+    virtual int min() const = 0;
+    virtual int max() const = 0;
+    // Deep copy; its nodes and arrays go to mem (null: the default resource).
+    virtual unique_ptr<Id_Index> clone(pmr::memory_resource* mem = nullptr) const = 0;
+    // Adds this index (including its own heap block) to r under part.
+    virtual void memory_usage(Memory_Report& r, const string& part) const = 0;
+
+    // Inserts n sorted keys. Backends with a cheaper bulk path override this.
+    virtual void insert_sorted(const int* keys, size_t n) {
+        for (size_t i = 0; i < n; ++i) insert(keys[i]);
+    }
+
+    // Visits the keys in [lo, hi) in increasing order, without allocating.
+    virtual void visit_range(int lo, int hi, Key_Visitor fn) const {
+        for (int k = successor(lo - 1); k != -1 && k < hi; k = successor(k)) fn(k);
+    }
+    // Keys per top-level block for parallel_for_each_in_range (VEB: a cluster).
+    virtual int split_span() const { return 64; }
+
+    virtual void enumerate(vector<int>& out) const {
+        for_each_in_range(0, universe(), [&](int k) { out.push_back(k); });
+    }
+
+    template <class Fn>
+    void for_each_in_range(int lo, int hi, Fn&& fn) const { visit_range(lo, hi, Key_Visitor(fn)); }
+    template <class Fn>
+    void for_each(Fn&& fn) const { visit_range(0, universe(), Key_Visitor(fn)); }
+    // fn(key, tid); blocks of split_span() keys are divided among the threads.
+    template <class Fn>
+    void parallel_for_each_in_range(int lo, int hi, int threads, Fn&& fn) const {
+        veb_parallel_for_each(*this, lo, hi, universe(), split_span(), threads, fn);
+    }
+
+    using iterator = Veb_Key_Iterator<Id_Index>;
+    iterator begin() const { return {this, min(), INT_MAX}; }
+    iterator end() const { return {this, -1, INT_MAX}; }
+    Veb_Key_Range<Id_Index> range(int lo, int hi) const {
+        int k = successor(lo - 1);
+        return {{this, (k >= hi) ? -1 : k, hi}};
+    }
+};
+
+// Adapter for the VEB classes above (they share one interface).
+template <class Veb>
+class Veb_Index : public Id_Index {
+public:
+    template <class... Args>
+    Veb_Index(const char* label, Args&&... args): tag(label), impl(std::forward<Args>(args)...) {}
+
+    const char* name() const override { return tag; }
+    int universe() const override { return impl.universe_size; }
+    void insert(int x) override { ARBOR_COUNT(veb_inserts, 1); impl.insert(x); }
+    void insert_sorted(const int* keys, size_t n) override { ARBOR_COUNT(veb_inserts, n); impl.insert_sorted(keys, n); }
+    bool contains(int x) const override { return impl.contains(x); }
+    bool erase(int x) override { return impl.erase(x); }
+    int successor(int x) const override { return impl.successor(x); }
+    int predecessor(int x) const override { return impl.predecessor(x); }
+    int min() const override { return impl.min(); }
+    int max() const override { return impl.max(); }
+    void enumerate(vector<int>& out) const override { impl.enumerate(out); }
+    void visit_range(int lo, int hi, Key_Visitor fn) const override { impl.for_each_in_range(lo, hi, fn); }
+    int split_span() const override { return impl.cluster_span(); }
+    void memory_usage(Memory_Report& r, const string& part) const override {
+        r.add_block(part, sizeof(*this));
+        impl.memory_usage(r, part);
+    }
+    unique_ptr<Id_Index> clone(pmr::memory_resource* mem = nullptr) const override {
+        if constexpr (is_constructible<Veb, const Veb&, pmr::memory_resource*>::value) {
+            return make_unique<Veb_Index>(tag, impl, mem);
+        } else {
+            return make_unique<Veb_Index>(*this);   // Static_Van_Emde_Boas: no heap
+        }
+    }
+
+    const Veb& tree() const { return impl; }
+
+private:
+    const char* tag;
+    Veb impl;
+};
+
+// One bit per possible ID; successor/predecessor scan whole words with ctz/clz.
+class Bitset_Index : public Id_Index {
+public:
+    explicit Bitset_Index(int size, pmr::memory_resource* mem = nullptr)
+        : u(std::max(size, 1)), words(((size_t)u + 63) / 64, 0, resource_or_default(mem)) {}
+    Bitset_Index(const Bitset_Index& o, pmr::memory_resource* mem)
+        : u(o.u), words(o.words, resource_or_default(mem)) {}
+
+    const char* name() const override { return "bitset"; }
+    unique_ptr<Id_Index> clone(pmr::memory_resource* mem = nullptr) const override {
+        return make_unique<Bitset_Index>(*this, mem);
+    }
+    int universe() const override { return u; }
+    void insert(int x) override { words[(size_t)x >> 6] |= 1ULL << (x & 63); }
+    bool contains(int x) const override {
+        return x >= 0 && x < u && ((words[(size_t)x >> 6] >> (x & 63)) & 1);
+    }
+    bool erase(int x) override {
+        if (!contains(x)) return false;
+        words[(size_t)x >> 6] &= ~(1ULL << (x & 63));
+        return true;
+    }
+    int successor(int x) const override {
+        int s = x + 1;
+        if (s < 0) s = 0;
+        if (s >= u) return -1;
+        size_t w = (size_t)s >> 6;
+        uint64_t m = words[w] & (~0ULL << (s & 63));
+        while (!m) {
+            if (++w == words.size()) return -1;
+            m = words[w];
+        }
+        return (int)(w * 64 + __builtin_ctzll(m));
+    }
+    int predecessor(int x) const override {
+        if (x <= 0) return -1;
+        int p = std::min(x, u) - 1;
+        size_t w = (size_t)p >> 6;
+        uint64_t m = words[w] & ((p & 63) == 63 ? ~0ULL : ((1ULL << ((p & 63) + 1)) - 1));
+        while (!m) {
+            if (w-- == 0) return -1;
+            m = words[w];
+        }
+        return (int)(w * 64 + 63 - __builtin_clzll(m));
+    }
+    int min() const override { return successor(-1); }
+    int max() const override { return predecessor(u); }
+    void visit_range(int lo, int hi, Key_Visitor fn) const override {
+        lo = std::max(lo, 0);
+        hi = std::min(hi, u);
+        if (hi <= lo) return;
+        size_t w = (size_t)lo >> 6, last = (size_t)(hi - 1) >> 6;
+        uint64_t m = words[w] & (~0ULL << (lo & 63));
+        for (;; m = words[++w]) {
+            if (w == last && (hi & 63)) m &= (1ULL << (hi & 63)) - 1;
+            for (; m; m &= m - 1) fn((int)(w * 64 + __builtin_ctzll(m)));
+            if (w == last) return;
+        }
+    }
+
+    void memory_usage(Memory_Report& r, const string& part) const override {
+        r.add_block(part, sizeof(*this));
+        r.add_vector(part, words);
+    }
+
+    // Number of stored keys (word popcounts).
+    size_t count() const {
+        size_t c = 0;
+        for (uint64_t w : words) c += (size_t)__builtin_popcountll(w);
+        return c;
+    }
+
+private:
+    int u;
+    pmr::vector<uint64_t> words;
+};
+
+// Sorted, deduplicated vector: O(log n) queries, O(1) amortized appends of
+// increasing IDs (the Arbor pattern), O(n) out-of-order inserts and erases.
+class Sorted_Vector_Index : public Id_Index {
+public:
+    explicit Sorted_Vector_Index(int size, pmr::memory_resource* mem = nullptr)
+        : u(std::max(size, 1)), keys(resource_or_default(mem)) {}
+    Sorted_Vector_Index(const Sorted_Vector_Index& o, pmr::memory_resource* mem)
+        : u(o.u), keys(o.keys, resource_or_default(mem)) {}
+
+    const char* name() const override { return "sorted_vector"; }
+    unique_ptr<Id_Index> clone(pmr::memory_resource* mem = nullptr) const override {
+        return make_unique<Sorted_Vector_Index>(*this, mem);
+    }
+    int universe() const override { return u; }
+    void insert(int x) override {
+        if (keys.empty() || x > keys.back()) { keys.push_back(x); return; }
+        auto it = lower_bound(keys.begin(), keys.end(), x);
+        if (*it != x) keys.insert(it, x);
+    }
+    void insert_sorted(const int* in, size_t n) override {
+        size_t old = keys.size();
+        keys.insert(keys.end(), in, in + n);
+        if (old && n && in[0] <= keys[old - 1]) inplace_merge(keys.begin(), keys.begin() + old, keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    }
+    bool contains(int x) const override { return binary_search(keys.begin(), keys.end(), x); }
+    bool erase(int x) override {
+        auto it = lower_bound(keys.begin(), keys.end(), x);
+        if (it == keys.end() || *it != x) return false;
+        keys.erase(it);
+        return true;
+    }
+    int successor(int x) const override {
+        auto it = upper_bound(keys.begin(), keys.end(), x);
+        return it == keys.end() ? -1 : *it;
+    }
+    int predecessor(int x) const override {
+        auto it = lower_bound(keys.begin(), keys.end(), x);
+        return it == keys.begin() ? -1 : *(it - 1);
+    }
+    int min() const override { return keys.empty() ? -1 : keys.front(); }
+    int max() const override { return keys.empty() ? -1 : keys.back(); }
+    void enumerate(vector<int>& out) const override { out.insert(out.end(), keys.begin(), keys.end()); }
+    void visit_range(int lo, int hi, Key_Visitor fn) const override {
+        for (auto it = lower_bound(keys.begin(), keys.end(), lo); it != keys.end() && *it < hi; ++it) fn(*it);
+    }
+    void memory_usage(Memory_Report& r, const string& part) const override {
+        r.add_block(part, sizeof(*this));
+        r.add_vector(part, keys);
+    }
+
+private:
+    int u;
+    pmr::vector<int> keys;
+};
+
+// std::set baseline.
+class Std_Set_Index : public Id_Index {
+public:
+    explicit Std_Set_Index(int size, pmr::memory_resource* mem = nullptr)
+        : u(std::max(size, 1)), keys(resource_or_default(mem)) {}
+    Std_Set_Index(const Std_Set_Index& o, pmr::memory_resource* mem)
+        : u(o.u), keys(o.keys, resource_or_default(mem)) {}
+
+    const char* name() const override { return "std_set"; }
+    unique_ptr<Id_Index> clone(pmr::memory_resource* mem = nullptr) const override {
+        return make_unique<Std_Set_Index>(*this, mem);
+    }
+    int universe() const override { return u; }
+    void insert(int x) override { keys.insert(x); }
+    void insert_sorted(const int* in, size_t n) override {
+        for (size_t i = 0; i < n; ++i) keys.insert(keys.end(), in[i]);   // hinted: O(1) amortized per append
+    }
+    bool contains(int x) const override { return keys.count(x) != 0; }
+    bool erase(int x) override { return keys.erase(x) != 0; }
+    int successor(int x) const override {
+        auto it = keys.upper_bound(x);
+        return it == keys.end() ? -1 : *it;
+    }
+    int predecessor(int x) const override {
+        auto it = keys.lower_bound(x);
+        return it == keys.begin() ? -1 : *prev(it);
+    }
+    int min() const override { return keys.empty() ? -1 : *keys.begin(); }
+    int max() const override { return keys.empty() ? -1 : *keys.rbegin(); }
+    void visit_range(int lo, int hi, Key_Visitor fn) const override {
+        for (auto it = keys.lower_bound(lo); it != keys.end() && *it < hi; ++it) fn(*it);
+    }
+    // One tree node per key: color + three links, then the value (libstdc++ layout).
+    void memory_usage(Memory_Report& r, const string& part) const override {
+        r.add_block(part, sizeof(*this));
+        r.add_blocks(part, 4 * sizeof(void*) + sizeof(int), keys.size());
+    }
+
+private:
+    int u;
+    pmr::set<int> keys;
+};
+
+enum class Index_Kind { VEB, VEB_POW2, VEB_FLAT, BITSET, SORTED_VECTOR, STD_SET };
+
+static const pair<const char*, Index_Kind> INDEX_KINDS[] = {
+    {"veb", Index_Kind::VEB}, {"veb_pow2", Index_Kind::VEB_POW2}, {"veb_flat", Index_Kind::VEB_FLAT},
+    {"bitset", Index_Kind::BITSET}, {"sorted_vector", Index_Kind::SORTED_VECTOR}, {"std_set", Index_Kind::STD_SET}};
+
+// Parses a backend name as reported by Id_Index::name(); false if unknown.
+inline bool parse_index_kind(string_view name, Index_Kind& out) {
+    for (auto& kv : INDEX_KINDS) if (name == kv.first) { out = kv.second; return true; }
+    return false;
+}
+
+// lazy only affects the pointer-based VEBs. mem holds the backend's nodes and
+// arrays (null: the default resource); the small Id_Index object itself is
+// always on the global heap.
+inline unique_ptr<Id_Index> make_id_index(Index_Kind kind, int universe, bool lazy, pmr::memory_resource* mem = nullptr) {
+    switch (kind) {
+        case Index_Kind::VEB:           return make_unique<Veb_Index<Van_Emde_Boas>>("veb", universe, lazy, mem);
+        case Index_Kind::VEB_POW2:      return make_unique<Veb_Index<Van_Emde_Boas_Pow2>>("veb_pow2", universe, lazy, mem);
+        case Index_Kind::VEB_FLAT:      return make_unique<Veb_Index<Flat_Van_Emde_Boas>>("veb_flat", universe, mem);
+        case Index_Kind::BITSET:        return make_unique<Bitset_Index>(universe, mem);
+        case Index_Kind::SORTED_VECTOR: return make_unique<Sorted_Vector_Index>(universe, mem);
+        case Index_Kind::STD_SET:       return make_unique<Std_Set_Index>(universe, mem);
+    }
+    return nullptr;
+}
+
+// ---------------------------- Batch range matching ----------------------------
+// Tests many keys against a few half-open ranges at once. Used for batch
+// ancestry (keys are preorder ranks, ranges are subtree intervals). The
+// kernel uses AVX2 (8 keys per step) or AArch64 NEON (4 per step) when the
+// target enables them, and a scalar loop otherwise and for the tail.
+struct Key_Range {
+    int lo, hi;   // [lo, hi)
+};
+
+// Sets bit i of mask[i / 64] iff keys[i] lies in at least one range; mask
+// must hold (n + 63) / 64 words. Empty or inverted ranges never match.
+inline void match_ranges(const int* keys, size_t n, const Key_Range* ranges, size_t nr, uint64_t* mask) {
+    // k in [lo, hi)  <=>  (unsigned)(k - lo) < (unsigned)(hi - lo)
+    vector<uint32_t> lo(nr), width(nr);
+    for (size_t r = 0; r < nr; ++r) {
+        lo[r] = (uint32_t)ranges[r].lo;
+        width[r] = ranges[r].hi > ranges[r].lo ? (uint32_t)ranges[r].hi - (uint32_t)ranges[r].lo : 0;
+    }
+    for (size_t b = 0; b < n; b += 64) {
+        size_t e = min(n, b + 64), i = b;
+        uint64_t m = 0;
+#if defined(__AVX2__)
+        // No unsigned 32-bit compare in AVX2: flip the sign bit and compare signed.
+        const __m256i bias = _mm256_set1_epi32(INT_MIN);
+        for (; i + 8 <= e; i += 8) {
+            __m256i k = _mm256_loadu_si256((const __m256i*)(keys + i));
+            __m256i hit = _mm256_setzero_si256();
+            for (size_t r = 0; r < nr; ++r) {
+                __m256i off = _mm256_xor_si256(_mm256_sub_epi32(k, _mm256_set1_epi32((int)lo[r])), bias);
+                __m256i w = _mm256_xor_si256(_mm256_set1_epi32((int)width[r]), bias);
+                hit = _mm256_or_si256(hit, _mm256_cmpgt_epi32(w, off));
+            }
+            m |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) << (i - b);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint32_t lane_bits[4] = {1, 2, 4, 8};
+        const uint32x4_t lanes = vld1q_u32(lane_bits);
+        for (; i + 4 <= e; i += 4) {
+            uint32x4_t k = vreinterpretq_u32_s32(vld1q_s32(keys + i));
+            uint32x4_t hit = vdupq_n_u32(0);
+            for (size_t r = 0; r < nr; ++r) {
+                hit = vorrq_u32(hit, vcltq_u32(vsubq_u32(k, vdupq_n_u32(lo[r])), vdupq_n_u32(width[r])));
+            }
+            m |= (uint64_t)vaddvq_u32(vandq_u32(hit, lanes)) << (i - b);
+        }
+#endif
+        for (; i < e; ++i) {
+            uint32_t k = (uint32_t)keys[i];
+            for (size_t r = 0; r < nr; ++r) {
+                if (k - lo[r] < width[r]) { m |= 1ULL << (i - b); break; }
+            }
+        }
+        mask[b / 64] = m;
+    }
+}
+
+// Writes ids[i] for every set bit i of mask to out (which needs room for n);
+// returns how many were written.
+inline size_t compact_matches(const int* ids, size_t n, const uint64_t* mask, int* out) {
+    size_t c = 0;
+    for (size_t w = 0; w * 64 < n; ++w) {
+        for (uint64_t m = mask[w]; m; m &= m - 1) out[c++] = ids[w * 64 + __builtin_ctzll(m)];
+    }
+    return c;
+}
+
+// unique_ptr that copies through T::clone(), so owners keep their implicit copy.
+template <class T>
+struct Cloned_Ptr : unique_ptr<T> {
+    Cloned_Ptr() = default;
+    Cloned_Ptr(unique_ptr<T>&& p): unique_ptr<T>(std::move(p)) {}
+    Cloned_Ptr(const Cloned_Ptr& o): unique_ptr<T>(o ? o->clone() : nullptr) {}
+    Cloned_Ptr(Cloned_Ptr&&) = default;
+    Cloned_Ptr& operator=(const Cloned_Ptr& o) {
+        if (this != &o) unique_ptr<T>::operator=(o ? o->clone() : nullptr);
+        return *this;
+    }
+    Cloned_Ptr& operator=(Cloned_Ptr&&) = default;
+    Cloned_Ptr& operator=(unique_ptr<T>&& p) { unique_ptr<T>::operator=(std::move(p)); return *this; }
+};
+
+// --------------------------------- Path cache ---------------------------------
+// Bounded (s, t) -> (distance, path) cache for skewed query mixes. Pairs are
+// stored unordered (path kept from the smaller ID) and spread over shards with
+// one mutex each, so concurrent readers rarely share a lock. Each shard evicts
+// with CLOCK: a hit sets the entry's reference bit; the hand clears set bits
+// and evicts the first entry whose bit is already clear. Each shard also
+// threads its entries onto one list per endpoint, so erase_node(v) visits only
+// v's entries. The byte budget covers entry and path storage plus an estimate
+// of the hash-map nodes.
+class Path_Cache {
+public:
+    explicit Path_Cache(size_t budget_bytes, int shard_count = 16)
+        : shard_budget(budget_bytes / (size_t)max(shard_count, 1)) {
+        for (int i = 0; i < max(shard_count, 1); ++i) shards.push_back(make_unique<Shard>());
+    }
+
+    // An empty cache with the same budget (cached paths belong to one Arbor version).
+    unique_ptr<Path_Cache> clone() const {
+        return make_unique<Path_Cache>(shard_budget * shards.size(), (int)shards.size());
+    }
+
+    // On a hit sets dist and, if path is non-null, appends the s -> t path.
+    // An entry stored without a path only satisfies distance lookups.
+    bool get(int s, int t, int& dist, vector<int>* path) {
+        uint64_t k = key(s, t);
+        Shard& sh = shard_of(k);
+        lock_guard<mutex> lock(sh.mu);
+        auto it = sh.where.find(k);
+        if (it == sh.where.end() || (path && !sh.ring[it->second].has_path)) {
+            misses_.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        Entry& e = sh.ring[it->second];
+        e.referenced = true;
+        dist = e.dist;
+        if (path) {
+            if (s <= t) path->insert(path->end(), e.path.begin(), e.path.end());
+            else path->insert(path->end(), e.path.rbegin(), e.path.rend());
+        }
+        hits_.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    // Stores a result; path (len nodes, s -> t) may be null to cache only the distance.
+    void put(int s, int t, int dist, const int* path, size_t len) {
+        uint64_t k = key(s, t);
+        size_t cost = entry_cost(path ? len : 0);
+        Shard& sh = shard_of(k);
+        if (cost > shard_budget) return;
+        lock_guard<mutex> lock(sh.mu);
+        auto it = sh.where.find(k);
+        if (it != sh.where.end()) {
+            if (sh.ring[it->second].has_path || !path) return;
+            evict(sh, it->second);   // upgrade a distance-only entry
+        }
+        while (sh.bytes + cost > shard_budget && !sh.where.empty()) advance_clock(sh);
+        uint32_t slot;
+        if (!sh.free_slots.empty()) { slot = sh.free_slots.back(); sh.free_slots.pop_back(); }
+        else { slot = (uint32_t)sh.ring.size(); sh.ring.emplace_back(); }
+        Entry& e = sh.ring[slot];
+        e.key = k; e.dist = dist; e.has_path = path != nullptr; e.referenced = false;
+        e.path.clear();
+        if (path) {
+            if (s <= t) e.path.assign(path, path + len);
+            else e.path.assign(reverse_iterator<const int*>(path + len), reverse_iterator<const int*>(path));
+        }
+        sh.where.emplace(k, slot);
+        link(sh, slot);
+        sh.bytes += cost;
+    }
+
+    // Drops every entry with v as an endpoint (e.g. v was unreachable and just
+    // got an edge); O(shards + entries involving v).
+    void erase_node(int v) {
+        for (auto& sh : shards) {
+            lock_guard<mutex> lock(sh->mu);
+            auto it = sh->heads.find(v);
+            if (it == sh->heads.end()) continue;
+            for (uint32_t slot = it->second; slot != NIL;) {
+                uint32_t next = sh->ring[slot].next[side_of(sh->ring[slot], v)];
+                evict(*sh, slot);
+                slot = next;
+            }
+        }
+    }
+
+    void clear() {
+        for (auto& sh : shards) {
+            lock_guard<mutex> lock(sh->mu);
+            sh->ring.clear(); sh->where.clear(); sh->heads.clear(); sh->free_slots.clear();
+            sh->hand = 0; sh->bytes = 0;
+        }
+    }
+
+    uint64_t hits() const { return hits_.load(memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(memory_order_relaxed); }
+    size_t entries() const {
+        size_t n = 0;
+        for (auto& sh : shards) { lock_guard<mutex> lock(sh->mu); n += sh->where.size(); }
+        return n;
+    }
+    size_t bytes_used() const {
+        size_t n = 0;
+        for (auto& sh : shards) { lock_guard<mutex> lock(sh->mu); n += sh->bytes; }
+        return n;
+    }
+
+    // Actual containers (bytes_used() is the budget's estimate). Hash nodes
+    // are counted as in entry_cost; a one-bucket table uses its built-in bucket.
+    void memory_usage(Memory_Report& r, const string& part) const {
+        r.add_block(part, sizeof(*this));
+        r.add_block(part, shards.capacity() * sizeof(shards[0]));
+        for (auto& sh : shards) {
+            lock_guard<mutex> lock(sh->mu);
+            r.add_block(part, sizeof(Shard));
+            r.add_vector(part, sh->ring);
+            for (const Entry& e : sh->ring) r.add_vector(part, e.path);
+            if (sh->where.bucket_count() > 1) r.add_block(part, sh->where.bucket_count() * sizeof(void*));
+            r.add_blocks(part, WHERE_NODE_BYTES, sh->where.size());
+            if (sh->heads.bucket_count() > 1) r.add_block(part, sh->heads.bucket_count() * sizeof(void*));
+            r.add_blocks(part, HEAD_NODE_BYTES, sh->heads.size());
+            r.add_vector(part, sh->free_slots);
+        }
+    }
+
+private:
+    static constexpr uint64_t EMPTY = ~0ULL;
+    static constexpr uint32_t NIL = ~0u;
+
+    // Side 0 links the entry into its smaller endpoint's list, side 1 into the
+    // larger one's; an (s, s) entry is only on side 0.
+    struct Entry {
+        uint64_t key = EMPTY;
+        int dist = -1;
+        bool has_path = false;
+        bool referenced = false;
+        uint32_t prev[2] = {NIL, NIL}, next[2] = {NIL, NIL};
+        vector<int> path;
+    };
+    struct Shard {
+        mutable mutex mu;
+        vector<Entry> ring;                       // CLOCK order; EMPTY keys are free
+        unordered_map<uint64_t, uint32_t> where;  // key -> ring slot
+        unordered_map<int, uint32_t> heads;       // endpoint -> first slot of its list
+        vector<uint32_t> free_slots;
+        size_t hand = 0;
+        size_t bytes = 0;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    size_t shard_budget;
+    atomic<uint64_t> hits_{0}, misses_{0};
+
+    static uint64_t key(int s, int t) {
+        if (s > t) std::swap(s, t);
+        return ((uint64_t)(uint32_t)s << 32) | (uint32_t)t;
+    }
+    // unordered_map nodes, estimated as key + value + next pointer + cached hash.
+    static constexpr size_t WHERE_NODE_BYTES = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(void*) + sizeof(size_t);
+    static constexpr size_t HEAD_NODE_BYTES = sizeof(int) + sizeof(uint32_t) + sizeof(void*) + sizeof(size_t);
+
+    // Entry + path + its where node + at most two endpoint heads.
+    static size_t entry_cost(size_t len) {
+        return sizeof(Entry) + len * sizeof(int) + WHERE_NODE_BYTES + 2 * HEAD_NODE_BYTES;
+    }
+
+    static int endpoint(uint64_t k, int side) { return side ? (int)(uint32_t)k : (int)(uint32_t)(k >> 32); }
+    static int sides(uint64_t k) { return endpoint(k, 0) == endpoint(k, 1) ? 1 : 2; }
+    static int side_of(const Entry& e, int v) { return endpoint(e.key, 0) == v ? 0 : 1; }
+
+    // Pushes slot onto the front of both of its endpoints' lists.
+    void link(Shard& sh, uint32_t slot) {
+        Entry& e = sh.ring[slot];
+        for (int side = 0; side < sides(e.key); ++side) {
+            int v = endpoint(e.key, side);
+            auto [it, fresh] = sh.heads.try_emplace(v, slot);
+            e.prev[side] = NIL;
+            e.next[side] = fresh ? NIL : it->second;
+            if (!fresh) {
+                Entry& old = sh.ring[it->second];
+                old.prev[side_of(old, v)] = slot;
+                it->second = slot;
+            }
+        }
+    }
+
+    void unlink(Shard& sh, uint32_t slot) {
+        Entry& e = sh.ring[slot];
+        for (int side = 0; side < sides(e.key); ++side) {
+            int v = endpoint(e.key, side);
+            uint32_t p = e.prev[side], n = e.next[side];
+            if (n != NIL) sh.ring[n].prev[side_of(sh.ring[n], v)] = p;
+            if (p != NIL) sh.ring[p].next[side_of(sh.ring[p], v)] = n;
+            else if (n != NIL) sh.heads[v] = n;
+            else sh.heads.erase(v);
+        }
+    }
+
+    Shard& shard_of(uint64_t k) { return *shards[(k * 0x9E3779B97F4A7C15ULL >> 32) % shards.size()]; }
+
+    void evict(Shard& sh, uint32_t slot) {
+        Entry& e = sh.ring[slot];
+        unlink(sh, slot);
+        sh.where.erase(e.key);
+        sh.bytes -= entry_cost(e.has_path ? e.path.size() : 0);
+        e.key = EMPTY;
+        vector<int>().swap(e.path);
+        sh.free_slots.push_back(slot);
+    }
+
+    void advance_clock(Shard& sh) {
+        for (;;) {
+            if (sh.hand >= sh.ring.size()) sh.hand = 0;
+            uint32_t slot = (uint32_t)sh.hand++;
+            Entry& e = sh.ring[slot];
+            if (e.key == EMPTY) continue;
+            if (e.referenced) { e.referenced = false; continue; }
+            evict(sh, slot);
+            return;
+        }
+    }
+};
+
+// ------------------------------ Weighted search -------------------------------
+// Monotone radix heap (Ahuja, Mehlhorn, Orlin, Tarjan) for Dijkstra: popped keys
+// never decrease, so entries are bucketed by the highest bit in which they
+// differ from the last popped key and each one is redistributed at most 64
+// times. Push is O(1); pop is amortized O(log C) for a maximum edge weight C.
+// Decrease-key is a fresh push; the caller skips stale entries when popped.
+class Radix_Heap {
+public:
+    void push(uint64_t key, int v) {
+        buckets[bucket_of(key)].push_back({key, v});
+        ++count;
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    // Smallest key; the heap must not be empty.
+    uint64_t top() {
+        refill();
+        return last;
+    }
+
+    pair<uint64_t,int> pop() {
+        refill();
+        auto e = buckets[0].back();
+        buckets[0].pop_back();
+        --count;
+        return e;
+    }
+
+    void clear() {
+        for (auto& b : buckets) b.clear();
+        last = 0;
+        count = 0;
+    }
+
+private:
+    array<vector<pair<uint64_t,int>>, 65> buckets;
+    uint64_t last = 0;
+    size_t count = 0;
+
+    size_t bucket_of(uint64_t key) const { return key == last ? 0 : 64 - (size_t)__builtin_clzll(key ^ last); }
+
+    // Moves the minimum of the first non-empty bucket into bucket 0.
+    void refill() {
+        if (!buckets[0].empty()) return;
+        size_t i = 1;
+        while (buckets[i].empty()) ++i;
+        uint64_t m = UINT64_MAX;
+        for (auto& e : buckets[i]) m = min(m, e.first);
+        last = m;
+        for (auto& e : buckets[i]) buckets[bucket_of(e.first)].push_back(e);
+        buckets[i].clear();
+    }
+};
+
+// Reusable Dijkstra state: one side per search direction. Entries are valid
+// only when stamped with the current epoch, so starting a query is O(1)
+// instead of an O(n) reset; the arrays grow to the largest graph seen.
+struct Dijkstra_Workspace {
+    struct Side {
+        vector<uint64_t> dist;
+        vector<int> parent;
+        vector<uint32_t> stamp;
+        Radix_Heap heap;
+    };
+    Side side[2];
+    uint32_t epoch = 0;
+
+    void begin(int n) {
+        for (auto& sd : side) {
+            if ((int)sd.stamp.size() < n) { sd.dist.resize(n); sd.parent.resize(n); sd.stamp.resize(n, 0); }
+            sd.heap.clear();
+        }
+        if (++epoch == 0) {  // wrapped: forget every stamp once
+            for (auto& sd : side) fill(sd.stamp.begin(), sd.stamp.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    inline uint64_t dist(int k, int v) const {
+        return side[k].stamp[v] == epoch ? side[k].dist[v] : UINT64_MAX;
+    }
+
+    inline void relax(int k, int v, uint64_t d, int parent) {
+        Side& sd = side[k];
+        sd.stamp[v] = epoch; sd.dist[v] = d; sd.parent[v] = parent;
+        sd.heap.push(d, v);
+    }
+};
+
+// One workspace per thread, shared by every Arbor the thread queries.
+inline Dijkstra_Workspace& thread_workspace() {
+    thread_local Dijkstra_Workspace ws;
+    return ws;
+}
+
+// ----------------------------- Arbor Porphyriana ------------------------------
+// Read-only view of a run of IDs (a neighbour or child list).
+struct Id_Span {
+    const int* first;
+    const int* last;
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+    size_t size() const { return (size_t)(last - first); }
+    bool empty() const { return first == last; }
+};
+
+// Tree index over raw arrays (binary lifting: up[v*LOG + k] is the 2^k-th
+// ancestor of v, roots point to themselves). Shared by Arbor and Mapped_Arbor,
+// which keep the tables in vectors or in a mapped snapshot respectively.
+struct Tree_Tables {
+    const int* parent;
+    const int* depth;
+    const int* up;
+    int LOG;
+
+    inline int ancestor(int v, int k) const { return up[(size_t)v * LOG + k]; }
+
+    // Lowest common ancestor, or -1 if a and b are in different trees.
+    int lca(int a, int b) const {
+        if (depth[a] < depth[b]) std::swap(a, b);
+        int diff = depth[a] - depth[b];
+        for (int k = 0; diff; ++k, diff >>= 1) if (diff & 1) a = ancestor(a, k);
+        if (a == b) return a;
+        for (int k = LOG - 1; k >= 0; --k) {
+            if (ancestor(a, k) != ancestor(b, k)) { a = ancestor(a, k); b = ancestor(b, k); }
+        }
+        a = ancestor(a, 0); b = ancestor(b, 0);
+        return (a == b) ? a : -1;
+    }
+
+    // Hop distance, -1 if unreachable.
+    int distance(int a, int b) const {
+        int w = lca(a, b);
+        return (w == -1) ? -1 : depth[a] + depth[b] - 2 * depth[w];
+    }
+
+    // Appends the a -> b path to out by walking both ends up to their LCA.
+    bool path(int a, int b, vector<int>& out) const {
+        int w = lca(a, b);
+        if (w == -1) return false;
+        for (int v = a; v != w; v = parent[v]) out.push_back(v);
+        out.push_back(w);
+        size_t mid = out.size();
+        for (int v = b; v != w; v = parent[v]) out.push_back(v);
+        reverse(out.begin() + mid, out.end());
+        return true;
+    }
+};
+
+// An Arbor's memory resource. Like a pmr container's allocator it is kept by
+// move construction, dropped by copy construction (a copy uses the default
+// resource) and never changed by assignment, so it always names the resource
+// the Arbor's containers actually allocate from.
+class Resource_Ref {
+public:
+    explicit Resource_Ref(pmr::memory_resource* m = nullptr): r(resource_or_default(m)) {}
+    Resource_Ref(const Resource_Ref&): r(pmr::get_default_resource()) {}
+    Resource_Ref(Resource_Ref&&) = default;
+    Resource_Ref& operator=(const Resource_Ref&) { return *this; }
+    Resource_Ref& operator=(Resource_Ref&&) { return *this; }
+    pmr::memory_resource* get() const { return r; }
+
+private:
+    pmr::memory_resource* r;
+};
+
+// An Arbor's ID index, kept in the Arbor's resource by the same rules as its
+// containers: assigning from an index that lives elsewhere clones it into home
+// (a moved-from Arbor's nodes may be in an arena about to be released), and
+// only a move between Arbors on the same resource takes the index over.
+class Index_Ptr : public Cloned_Ptr<Id_Index> {
+public:
+    explicit Index_Ptr(pmr::memory_resource* m): home(m) {}
+    Index_Ptr(const Index_Ptr& o): Cloned_Ptr<Id_Index>(o), home(pmr::get_default_resource()) {}
+    Index_Ptr(Index_Ptr&&) = default;
+    Index_Ptr& operator=(const Index_Ptr& o) {
+        if (this != &o) unique_ptr<Id_Index>::operator=(o ? o->clone(home) : nullptr);
+        return *this;
+    }
+    Index_Ptr& operator=(Index_Ptr&& o) {
+        if (home != o.home) return *this = static_cast<const Index_Ptr&>(o);
+        unique_ptr<Id_Index>::operator=(std::move(o));
+        return *this;
+    }
+    Index_Ptr& operator=(unique_ptr<Id_Index>&& p) { unique_ptr<Id_Index>::operator=(std::move(p)); return *this; }
+
+private:
+    pmr::memory_resource* home;   // where this Arbor's index nodes live
+};
+
+struct Arbor {
+    Resource_Ref mem;                           // backs every container below and the ID index
+    pmr::vector<pmr::vector<int>> adj{mem.get()};            // adjacency list (undirected)
+    pmr::vector<pmr::vector<uint32_t>> adj_weight{mem.get()}; // parallel to adj; empty until a weighted edge
+    bool weighted = false;                      // some edge has a non-unit weight
+    Label_Interner labels{mem.get()};           // label <-> id
+    pmr::vector<int> parent_of{mem.get()};      // id -> parent id (-1 for roots)
+    int edge_count = 0;                         // undirected edges added so far
+
+    Index_Ptr veb{mem.get()};                   // ID index (a VEB unless configured otherwise)
+    int U;                                      // capacity / universe size (grows on demand)
+    bool lazy_veb;                              // VEB clusters allocated on demand
+    Index_Kind index_kind;                      // backend used for veb
+
+    // lazy: allocate VEB clusters on demand (recommended for large, sparse U).
+    // kind: ID index backend; Index_Kind::VEB is the original Van_Emde_Boas.
+    // resource: where the adjacency, labels, tables and index nodes live, e.g.
+    // a pmr::monotonic_buffer_resource per taxonomy so building is bump-pointer
+    // allocation and dropping it is one release(); it must outlive the Arbor.
+    // Null means the default resource. The path cache stays on the global heap.
+    explicit Arbor(int universe_size = 128, bool lazy = false, Index_Kind kind = Index_Kind::VEB,
+                   pmr::memory_resource* resource = nullptr)
+        : mem(resource), U(max(universe_size, 1)), lazy_veb(lazy), index_kind(kind) {
+        veb = make_id_index(index_kind, U, lazy_veb, mem.get());
+    }
+
+    pmr::memory_resource* resource() const { return mem.get(); }
+
+    // Size everything for n concepts up front so bulk loads never regrow.
+    // size_index = false leaves the ID index alone, for callers whose n is only
+    // an upper bound: a deferred load sizes the index from the real size() in
+    // sync_index().
+    void reserve(int n, bool size_index = true) {
+        if (size_index && n > U) grow_universe(n);
+        adj.reserve(n);
+        labels.reserve(n);
+        parent_of.reserve(n);
+        tin.reserve(n);
+        tout.reserve(n);
+    }
+
+    // Rebuild the VEB over a universe of at least min_u keys. Called with a
+    // doubled size when ensure_node runs out of room, so the rebuild cost is
+    // amortized O(1) per inserted concept.
+    void grow_universe(int min_u) {
+        int new_u = universe_for(min_u);
+        if (new_u == U) return;
+        auto grown = make_id_index(index_kind, new_u, lazy_veb, mem.get());
+        vector<int> keys;
+        veb->enumerate(keys);
+        grown->insert_sorted(keys.data(), keys.size());
+        veb = std::move(grown);
+        U = new_u;
+    }
+
+    // U doubled until it holds min_u keys.
+    int universe_for(int min_u) const {
+        int new_u = U;
+        while (new_u < min_u) new_u = (new_u > INT_MAX / 2) ? INT_MAX : new_u * 2;
+        return new_u;
+    }
+
+    // Switches to a compile-time index such as Static_Van_Emde_Boas<8> (for
+    // when U is known at build time), carrying over the current IDs. If the IDs
+    // later outgrow it, grow_universe moves back to a runtime index_kind index.
+    // False (nothing changed) if the current IDs do not fit.
+    template <class Veb>
+    bool use_index(const char* name) {
+        if (Veb::universe_size < size()) return false;
+        auto fixed = make_unique<Veb_Index<Veb>>(name);
+        vector<int> keys;
+        veb->enumerate(keys);
+        fixed->insert_sorted(keys.data(), keys.size());
+        veb = std::move(fixed);
+        U = Veb::universe_size;
+        return true;
+    }
+
+    // Bulk loads: between defer_index() and sync_index(), new IDs are not put
+    // into veb one by one, and U is not grown for them; sync_index() sizes the
+    // universe once for the final size() and adds them all with insert_sorted
+    // (they are consecutive). Nothing in between may query veb.
+    int index_pending = -1;                     // first deferred ID, -1 if not deferring
+
+    void defer_index() { if (index_pending < 0) index_pending = size(); }
+    void sync_index() {
+        if (index_pending < 0) return;
+        int first = index_pending;
+        index_pending = -1;
+        if (first == size()) return;
+        vector<int> ids((size_t)(size() - first));
+        iota(ids.begin(), ids.end(), first);
+        int new_u = universe_for(size());
+        Index_Kind kind;
+        bool rebuild = new_u != U || (veb->min() != -1 && ids.size() >= (size_t)first &&
+                                      parse_index_kind(veb->name(), kind) && kind == index_kind);
+        if (rebuild) {
+            // Outgrown, or at least doubling: one bottom-up build over
+            // everything beats descending the existing tree for each new ID.
+            vector<int> keys;
+            veb->enumerate(keys);
+            keys.insert(keys.end(), ids.begin(), ids.end());
+            auto fresh = make_id_index(index_kind, new_u, lazy_veb, mem.get());
+            fresh->insert_sorted(keys.data(), keys.size());
+            veb = std::move(fresh);
+            U = new_u;
+        } else {
+            veb->insert_sorted(ids.data(), ids.size());
+        }
+    }
+
+    inline int size() const { return labels.size(); }
+
+    // Heap footprint by component: adjacency, labels (label_of arena/offsets
+    // and the id_of table), parent links, CSR, tree index, intervals, the ID
+    // index (named "index:<backend>", with per-level VEB shape) and the path
+    // cache. See Memory_Report for what the numbers include.
+    Memory_Report memory_usage() const {
+        Memory_Report r;
+        r.add_vector("adj", adj);
+        for (auto& a : adj) r.add_vector("adj", a);
+        r.add_vector("adj_weight", adj_weight);
+        for (auto& w : adj_weight) r.add_vector("adj_weight", w);
+        labels.memory_usage(r);
+        r.add_vector("parent_of", parent_of);
+        r.add_vector("csr", csr.offsets);
+        r.add_vector("csr", csr.nbrs);
+        r.add_vector("csr", csr.child_begin);
+        r.add_vector("csr", csr.child_end);
+        r.add_vector("csr", csr.weights);
+        r.add_vector("tree_index", depth);
+        r.add_vector("tree_index", up);
+        r.add_vector("intervals", tin);
+        r.add_vector("intervals", tout);
+        veb->memory_usage(r, string("index:") + veb->name());
+        if (path_cache) path_cache->memory_usage(r, "path_cache");
+        return r;
+    }
+
+    // -1 if the label is unknown.
+    inline int id_of(string_view label) const { return labels.find(label); }
+    // View into the label arena; valid until the next ensure_node.
+    inline string_view label_of(int id) const { return labels.view(id); }
+
+    int ensure_node(string_view label) { return ensure_node(label, Label_Interner::hash_of(label)); }
+
+    // Same, with the label's hash_of() already computed (bulk loaders hash in parallel).
+    int ensure_node(string_view label, uint32_t h) {
+        int found = labels.find(label, h);
+        if (found != -1) return found;
+        return add_new_node(label, h);
+    }
+
+    // Appends a node whose label the caller knows is not present yet.
+    int add_new_node(string_view label, uint32_t h) {
+        int id = size();
+        if (id >= U && index_pending < 0) grow_universe(id + 1);
+        labels.append(label, h);
+        parent_of.push_back(-1);
+        if ((int)adj.size() <= id) adj.resize(id + 1);
+        if (weighted) adj_weight.resize(adj.size());
+        if (index_pending < 0) veb->insert(id);
+        // A new node is an isolated root: extend the indexes instead of dropping them.
+        if (frozen) {
+            int end = csr.offsets.back();
+            csr.offsets.push_back(end);
+            csr.child_begin.push_back(end);
+            csr.child_end.push_back(end);
+        }
+        if (tree_ready) { depth.push_back(0); up.insert(up.end(), LOG, id); }
+        // It is also the last root in preorder, so [id, id + 1) is its interval;
+        // while the intervals are dirty this is a placeholder that keeps tin/tout
+        // as long as the ID space.
+        tin.push_back(id);
+        tout.push_back(id + 1);
+        return id;
+    }
+
+    // weight: edge cost for weighted_path (differentia strength etc.); hop-based
+    // queries ignore it.
+    // child may be a label_of() view, which interning a new parent invalidates:
+    // it is resolved first, or copied if it is new (a new parent still gets
+    // the lower ID).
+    void connect_parent_child(string_view parent, string_view child, uint32_t weight = 1) {
+        uint32_t hc = Label_Interner::hash_of(child);
+        int c = labels.find(child, hc);
+        string copy;
+        if (c == -1 && labels.in_arena(child)) { copy.assign(child); child = copy; }
+        int p = ensure_node(parent);
+        if (c == -1) c = ensure_node(child, hc);
+        connect_ids(p, c, weight);
+    }
+
+    // Adds the parent -> child edge between two existing IDs.
+    // Attaching a fresh leaf (an isolated node) keeps the tree index current in
+    // O(log n), and only the cached entries ending at the leaf (all of them
+    // "unreachable") are dropped: no other shortest path can pass through it.
+    // The preorder intervals are only marked dirty (see refresh_intervals()).
+    // Any other edge drops the index and the whole cache.
+    void connect_ids(int p, int c, uint32_t weight = 1) {
+        bool leaf = tree_ready && c != p && parent_of[c] == -1 && adj[c].empty();
+        if (weight != 1 && !weighted) enable_weights();
+        adj[p].push_back(c);
+        adj[c].push_back(p);
+        if (weighted) { adj_weight[p].push_back(weight); adj_weight[c].push_back(weight); }
+        if (parent_of[c] == -1 && c != p) parent_of[c] = p;
+        ++edge_count;
+        frozen = false;
+        intervals_ready = false;
+        preorder_ids = false;
+        if (leaf) {
+            if (!extend_tree_index(c)) build_tree_index();
+            if (path_cache) path_cache->erase_node(c);
+            return;
+        }
+        tree_ready = false;
+        if (path_cache) path_cache->clear();
+    }
+
+    // Switches to explicit weights; edges so far get weight 1.
+    void enable_weights() {
+        adj_weight.resize(adj.size());
+        for (size_t u = 0; u < adj.size(); ++u) adj_weight[u].assign(adj[u].size(), 1);
+        weighted = true;
+        frozen = false;
+    }
+
+    // ------------------------------ CSR snapshot ------------------------------
+    // Compact adjacency built by freeze(): one offsets array plus one neighbour
+    // array. Each node's run is laid out as [parent][children...][other links...],
+    // so children(u) is a contiguous slice and never needs the parent filtered out.
+    struct Csr {
+        explicit Csr(pmr::memory_resource* m): offsets(m), nbrs(m), child_begin(m), child_end(m), weights(m) {}
+        pmr::vector<int> offsets;       // n+1: neighbours of u are nbrs[offsets[u] .. offsets[u+1])
+        pmr::vector<int> nbrs;
+        pmr::vector<int> child_begin;   // n: children of u are nbrs[child_begin[u] .. child_end[u])
+        pmr::vector<int> child_end;
+        pmr::vector<uint32_t> weights;  // parallel to nbrs when the Arbor is weighted
+    } csr{mem.get()};
+    bool frozen = false;           // csr is current; reset by any mutation
+
+    // Packs adj into csr and builds the tree index; read-only queries use the
+    // compact form from here on. Returns build_tree_index()'s result.
+    bool freeze() {
+        ARBOR_TIMER(freeze);
+        ARBOR_ALLOC_SCOPE(freeze);
+        int n = size();
+        csr.offsets.assign(n + 1, 0);
+        csr.nbrs.resize((size_t)2 * edge_count);
+        csr.child_begin.assign(n, 0);
+        csr.child_end.assign(n, 0);
+        csr.weights.resize(weighted ? csr.nbrs.size() : 0);
+        vector<int> seen(n, -1);  // child already placed for this u
+        int pos = 0;
+        auto place = [&](int u, size_t j) {
+            if (weighted) csr.weights[pos] = adj_weight[u][j];
+            csr.nbrs[pos++] = adj[u][j];
+        };
+        for (int u = 0; u < n; ++u) {
+            csr.offsets[u] = pos;
+            int p = parent_of[u];
+            bool parent_done = (p == -1);
+            const auto& a = adj[u];
+            if (!parent_done) place(u, (size_t)(find(a.begin(), a.end(), p) - a.begin()));
+            csr.child_begin[u] = pos;
+            for (size_t j = 0; j < a.size(); ++j) {
+                int v = a[j];
+                // v != p: with a parent 2-cycle, p would otherwise be placed twice.
+                if (v != p && parent_of[v] == u && seen[v] != u) { seen[v] = u; place(u, j); }
+            }
+            csr.child_end[u] = pos;
+            // Everything else: duplicate edges, extra parents, self-links.
+            for (size_t j = 0; j < a.size(); ++j) {
+                int v = a[j];
+                if (v == p && !parent_done) { parent_done = true; continue; }
+                if (parent_of[v] == u && seen[v] == u) { seen[v] = -2 - u; continue; }
+                place(u, j);
+            }
+        }
+        csr.offsets[n] = pos;
+        frozen = true;
+        return build_tree_index();
+    }
+
+    inline Id_Span neighbors(int u) const {
+        if (frozen) return {csr.nbrs.data() + csr.offsets[u], csr.nbrs.data() + csr.offsets[u + 1]};
+        return {adj[u].data(), adj[u].data() + adj[u].size()};
+    }
+
+    // Weights parallel to neighbors(u), or nullptr when every edge has weight 1.
+    inline const uint32_t* neighbor_weights(int u) const {
+        if (!weighted) return nullptr;
+        return frozen ? csr.weights.data() + csr.offsets[u] : adj_weight[u].data();
+    }
+
+    // Children of u; only available once frozen.
+    inline Id_Span children(int u) const {
+        return {csr.nbrs.data() + csr.child_begin[u], csr.nbrs.data() + csr.child_end[u]};
+    }
+
+    // ------------------------- Tree distance engine (LCA) -------------------------
+    // Binary lifting over parent_of: up[v*LOG + k] is the 2^k-th ancestor of v
+    // (roots point to themselves). Built once in O(n log n); afterwards a distance
+    // query is O(log n) and a path is reconstructed in O(path length).
+    pmr::vector<int> depth{mem.get()};          // id -> depth (roots are 0)
+    pmr::vector<int> up{mem.get()};             // n * LOG ancestor table
+    int LOG = 1;
+    bool tree_ready = false;                    // false until built / after mutation
+
+    // Returns false (and leaves the index disabled) if the graph is not a forest,
+    // e.g. a concept was given two parents; shortest_path then falls back to Dijkstra.
+    bool build_tree_index() {
+        tree_ready = false;
+        int n = size();
+        int tree_edges = 0;
+        for (int v = 0; v < n; ++v) tree_edges += (parent_of[v] != -1);
+        if (tree_edges != edge_count) return false;
+
+        // BFS from the roots so every parent is settled before its children.
+        depth.assign(n, -1);
+        vector<int> order; order.reserve(n);
+        for (int v = 0; v < n; ++v) if (parent_of[v] == -1) { depth[v] = 0; order.push_back(v); }
+        for (size_t i = 0; i < order.size(); ++i) {
+            int u = order[i];
+            for (int v : neighbors(u)) if (parent_of[v] == u && depth[v] == -1) {
+                depth[v] = depth[u] + 1;
+                order.push_back(v);
+            }
+        }
+        if ((int)order.size() != n) return false;  // a parent cycle
+
+        int max_depth = 0;
+        for (int d : depth) max_depth = max(max_depth, d);
+        LOG = 1;
+        while ((1 << LOG) <= max_depth) ++LOG;
+        up.assign((size_t)n * LOG, 0);
+        for (int v : order) {
+            int* row = &up[(size_t)v * LOG];
+            row[0] = (parent_of[v] == -1) ? v : parent_of[v];
+            for (int k = 1; k < LOG; ++k) row[k] = up[(size_t)row[k - 1] * LOG + k - 1];
+        }
+        tree_ready = true;
+        return true;
+    }
+
+    // Fills in depth and the ancestor row of c, a leaf that just got its parent.
+    // False if c is deeper than the table covers (2^LOG), which needs a rebuild.
+    bool extend_tree_index(int c) {
+        int p = parent_of[c];
+        if (depth[p] + 1 >= (1 << LOG)) return false;
+        depth[c] = depth[p] + 1;
+        int* row = &up[(size_t)c * LOG];
+        row[0] = p;
+        for (int k = 1; k < LOG; ++k) row[k] = up[(size_t)row[k - 1] * LOG + k - 1];
+        return true;
+    }
+
+    inline Tree_Tables tables() const { return {parent_of.data(), depth.data(), up.data(), LOG}; }
+    inline int lca(int a, int b) const { return tables().lca(a, b); }
+    // Hop distance between two IDs via the tree index, -1 if unreachable.
+    inline int tree_distance(int a, int b) const { return tables().distance(a, b); }
+    // Appends the a -> b path to out by walking both ends up to their LCA.
+    inline bool tree_path(int a, int b, vector<int>& out) const { return tables().path(a, b, out); }
+
+    // ------------------- Preorder intervals / ID renumbering --------------------
+    // tin[v] is v's rank in a DFS preorder of the forest (roots in ID order,
+    // children in insertion order) and tout[v] = tin[v] + subtree size, so u lies
+    // in v's subtree iff tin[v] <= tin[u] < tout[v]. After renumber_preorder() a
+    // node's ID is its tin, so every subtree is the contiguous ID range [v, tout[v]).
+    pmr::vector<int> tin{mem.get()}, tout{mem.get()};
+    bool intervals_ready = false;               // false until built / after mutation
+    bool preorder_ids = false;                  // IDs equal tin (renumber_preorder)
+
+    // Computes tin/tout in O(n); freezes first if needed. False if not a forest.
+    bool build_intervals() {
+        intervals_ready = false;
+        if (!frozen) freeze();
+        if (!tree_ready) return false;
+        fill_intervals();
+        return true;
+    }
 
-// ----------------------------- Van Emde Boas Tree -----------------------------
-class Van_Emde_Boas {
-public:
-    int universe_size;  // U
-    int minimum;        // min key or -1 if empty
-    int maximum;        // max key or -1 if empty
-    Van_Emde_Boas* summary;                 // VEB(sqrt(U))
-    vector<Van_Emde_Boas*> clusters;        // sqrt(U) clusters, each VEB(sqrt(U))
+    // The preorder walk behind build_intervals() and refresh_intervals(). Reads
+    // only parent_of / adj, so it needs tree_ready (a forest) but not a current
+    // csr: children come out in insertion order either way.
+    void fill_intervals() {
+        int n = size();
+        tin.assign(n, -1);
+        tout.assign(n, 0);
+        vector<int> order, stack;
+        order.reserve(n);
+        for (int r = n - 1; r >= 0; --r) if (parent_of[r] == -1) stack.push_back(r);
+        while (!stack.empty()) {
+            int u = stack.back(); stack.pop_back();
+            tin[u] = (int)order.size();
+            order.push_back(u);
+            const auto& a = adj[u];
+            for (size_t j = a.size(); j-- > 0;) if (parent_of[a[j]] == u) stack.push_back(a[j]);
+        }
+        // Subtree sizes bottom-up: every child follows its parent in preorder.
+        vector<int> sz(n, 1);
+        for (int i = n - 1; i >= 0; --i) {
+            int v = order[i];
+            if (parent_of[v] != -1) sz[parent_of[v]] += sz[v];
+        }
+        for (int v = 0; v < n; ++v) tout[v] = tin[v] + sz[v];
+        intervals_ready = true;
+    }
 
-    explicit Van_Emde_Boas(int size): universe_size(size), minimum(-1), maximum(-1), summary(nullptr) {
-        if (size <= 2) {
-            clusters = vector<Van_Emde_Boas*>(0, nullptr);
-        } else {
-            int no_clusters = (int)ceil(sqrt((double)size));
-            summary = new Van_Emde_Boas(no_clusters);
-            clusters = vector<Van_Emde_Boas*>(no_clusters, nullptr);
-            for (int i = 0; i < no_clusters; i++) {
-                clusters[i] = new Van_Emde_Boas((int)ceil(sqrt((double)size)));
-            }
+    // Relabels every node with its preorder rank so subtrees are contiguous in
+    // the ID space (and in adj / csr / the VEB clusters). Returns old id -> new id,
+    // or an empty vector if the graph is not a forest. IDs held by callers must
+    // be remapped; labels are unchanged.
+    vector<int> renumber_preorder() {
+        if (!build_intervals()) return {};
+        int n = size();
+        const pmr::vector<int>& new_id = tin;
+        vector<int> old_id(n);
+        for (int v = 0; v < n; ++v) old_id[new_id[v]] = v;
+
+        Label_Interner fresh(mem.get());
+        fresh.reserve(n, labels.arena.size());
+        pmr::vector<pmr::vector<int>> fresh_adj(n, mem.get());
+        pmr::vector<int> fresh_parent(n, -1, mem.get());
+        for (int i = 0; i < n; ++i) {
+            int v = old_id[i];
+            string_view lab = labels.view(v);
+            fresh.append(lab, Label_Interner::hash_of(lab));
+            if (parent_of[v] != -1) fresh_parent[i] = new_id[parent_of[v]];
+            fresh_adj[i].reserve(adj[v].size());
+            for (int w : adj[v]) fresh_adj[i].push_back(new_id[w]);
+        }
+        if (weighted) {
+            pmr::vector<pmr::vector<uint32_t>> fresh_weight(n, mem.get());
+            for (int i = 0; i < n; ++i) fresh_weight[i] = std::move(adj_weight[old_id[i]]);
+            adj_weight = std::move(fresh_weight);
         }
+        vector<int> mapping(new_id.begin(), new_id.end());
+        labels = std::move(fresh);
+        adj = std::move(fresh_adj);
+        parent_of = std::move(fresh_parent);
+        // The ID set is still [0, n), so the VEB needs no rebuild.
+        frozen = false;
+        freeze();
+        build_intervals();
+        preorder_ids = true;
+        if (path_cache) path_cache->clear();
+        return mapping;
     }
 
-    ~Van_Emde_Boas() {
-        if (summary) delete summary;
-        for (auto* c : clusters) delete c;
+    // Recomputes dirty intervals (after leaf insertions); call once per batch of
+    // updates rather than per query. Leaf insertions keep the tree index, so this
+    // is just the O(n) walk: no freeze() and no LCA rebuild. Any other edge falls
+    // back to build_intervals(). False if the graph is not a forest.
+    bool refresh_intervals() {
+        if (intervals_ready) return true;
+        if (!tree_ready) return build_intervals();
+        fill_intervals();
+        return true;
     }
 
-    inline int high(int x) const { int d = (int)ceil(sqrt((double)universe_size)); return x / d; }
-    inline int low(int x)  const { int m = (int)ceil(sqrt((double)universe_size)); return x % m; }
-    inline int generate_index(int x, int y) const { int ru = (int)ceil(sqrt((double)universe_size)); return x * ru + y; }
+    // O(1): is u in the subtree rooted at v (u == v counts)? Needs current
+    // intervals (build_intervals() / refresh_intervals() after a mutation).
+    inline bool is_descendant(int u, int v) const {
+        assert(intervals_ready);
+        return tin[v] <= tin[u] && tin[u] < tout[v];
+    }
 
-    inline bool empty() const { return minimum == -1; }
+    // All IDs in v's subtree, in ID order, as a VEB successor scan over
+    // [v, tout[v]). Needs renumber_preorder(), and again after any new edge.
+    inline Veb_Key_Range<Id_Index> descendants(int v) const {
+        assert(preorder_ids && intervals_ready);
+        return veb->range(v, tout[v]);
+    }
 
-    void empty_insert(int x) { minimum = maximum = x; }
+    // Batch ancestry: bit i of mask is set iff ids[i] is in the subtree of any
+    // of genera[0..ng) (a genus counts as its own descendant). Needs
+    // build_intervals(); after renumber_preorder() the IDs are matched directly,
+    // otherwise their preorder ranks are gathered first.
+    void descendants_mask(const int* ids, size_t n, const int* genera, size_t ng, vector<uint64_t>& mask) const {
+        assert(intervals_ready);
+        vector<Key_Range> ranges(ng);
+        for (size_t g = 0; g < ng; ++g) ranges[g] = {tin[genera[g]], tout[genera[g]]};
+        mask.resize((n + 63) / 64);
+        if (preorder_ids) { match_ranges(ids, n, ranges.data(), ng, mask.data()); return; }
+        vector<int> keys(n);
+        for (size_t i = 0; i < n; ++i) keys[i] = tin[ids[i]];
+        match_ranges(keys.data(), n, ranges.data(), ng, mask.data());
+    }
 
-    bool contains(int x) const {
-        if (x == minimum || x == maximum) return true;
-        if (universe_size <= 2) return false;
-        int h = high(x), l = low(x);
-        if (h < 0 || h >= (int)clusters.size()) return false;
-        if (!clusters[h] || clusters[h]->empty()) return false;
-        return clusters[h]->contains(l);
+    // Same test, returning the matching IDs (in input order) in out.
+    size_t filter_descendants(const int* ids, size_t n, const int* genera, size_t ng, vector<int>& out) const {
+        vector<uint64_t> mask;
+        descendants_mask(ids, n, genera, ng, mask);
+        out.resize(n);
+        out.resize(compact_matches(ids, n, mask.data(), out.data()));
+        return out.size();
     }
 
-    void insert(int x) {
-        if (minimum == -1) { // empty tree
-            empty_insert(x);
-            return;
+    // ------------------------------- Path cache -------------------------------
+    // Optional; consulted by distance / shortest_path and the batch queries, and
+    // cleared by every edge mutation and by renumber_preorder().
+    Cloned_Ptr<Path_Cache> path_cache;          // copies start empty
+
+    void enable_path_cache(size_t budget_bytes) { path_cache = make_unique<Path_Cache>(budget_bytes); }
+    void disable_path_cache() { path_cache.reset(); }
+
+    // Hop distance by label (-1 if unknown or unreachable).
+    int distance(string_view a, string_view b) const {
+        ARBOR_COUNT(path_queries, 1);
+        int s = id_of(a), t = id_of(b);
+        if (s == -1 || t == -1) return -1;
+        thread_local Bidi_Scratch sc;
+        vector<int> path;
+        return hop_distance(s, t, sc, path);
+    }
+
+    // Shortest (fewest-hop) path by label: LCA walk when the tree index is
+    // built, otherwise bidirectional BFS. Edge weights are never used here; see
+    // weighted_shortest_path.
+    vector<int> shortest_path(string_view a, string_view b) const {
+        ARBOR_TIMER(shortest_path);
+        ARBOR_COUNT(path_queries, 1);
+        int s = id_of(a), t = id_of(b);
+        if (s == -1 || t == -1) return {};
+        thread_local Bidi_Scratch sc;
+        vector<int> path;
+        hop_path(s, t, sc, path);
+        return path;
+    }
+
+    // ----------------------------- Batch queries ------------------------------
+    // Flattened result of batch_paths: path i is nodes[offsets[i] .. offsets[i+1]).
+    struct Path_Batch {
+        vector<size_t> offsets;
+        vector<int> nodes;
+    };
+
+    // Per-worker scratch for the non-tree fallback; reset by touched list so a
+    // query costs O(visited), not O(n).
+    struct Bfs_Scratch {
+        vector<int> dist, parent, queue, touched;
+    };
+
+    // One-sided unit-weight BFS; appends the s -> t path to out. Kept as the
+    // reference for bidirectional_bfs below.
+    bool bfs_path(int s, int t, Bfs_Scratch& sc, vector<int>& out) const {
+        int n = size();
+        if ((int)sc.dist.size() < n) { sc.dist.assign(n, -1); sc.parent.assign(n, -1); }
+        sc.queue.clear();
+        sc.dist[s] = 0; sc.touched.push_back(s); sc.queue.push_back(s);
+        for (size_t i = 0; i < sc.queue.size() && sc.dist[t] == -1; ++i) {
+            int u = sc.queue[i];
+            ARBOR_COUNT(path_nodes_settled, 1);
+            for (int v : neighbors(u)) if (sc.dist[v] == -1) {
+                sc.dist[v] = sc.dist[u] + 1; sc.parent[v] = u;
+                sc.touched.push_back(v); sc.queue.push_back(v);
+                ARBOR_COUNT(path_heap_pushes, 1);
+            }
         }
-        if (x < minimum) std::swap(x, minimum);
+        bool found = sc.dist[t] != -1;
+        if (found) {
+            size_t mid = out.size();
+            for (int cur = t; cur != s; cur = sc.parent[cur]) out.push_back(cur);
+            out.push_back(s);
+            reverse(out.begin() + mid, out.end());
+        }
+        for (int v : sc.touched) { sc.dist[v] = -1; sc.parent[v] = -1; }
+        sc.touched.clear();
+        return found;
+    }
 
-        if (universe_size > 2) {
-            int h = high(x);
-            int l = low(x);
-            if (clusters[h]->minimum == -1) {
-                summary->insert(h);
-                clusters[h]->empty_insert(l);
-            } else {
-                clusters[h]->insert(l);
+    // Scratch for bidirectional_bfs: one visited bitset per side, sized from the
+    // ID universe, cleared through the visited lists so a query costs O(visited).
+    struct Bidi_Scratch {
+        vector<uint64_t> seen[2];
+        vector<int> parent[2];      // valid where the side's bit is set
+        vector<int> visited[2];
+        vector<int> frontier[2], next;
+    };
+
+    // Level-synchronous BFS from both ends, always expanding the smaller
+    // frontier; stops at the first node reached from both sides, which closes
+    // a shortest path. Appends the s -> t path to out.
+    bool bidirectional_bfs(int s, int t, Bidi_Scratch& sc, vector<int>& out) const {
+        size_t words = ((size_t)max(veb->universe(), size()) + 63) / 64;
+        if (sc.seen[0].size() < words) {
+            for (int k = 0; k < 2; ++k) { sc.seen[k].assign(words, 0); sc.parent[k].resize(words * 64); }
+        }
+        auto seen = [&](int k, int v) { return (sc.seen[k][(size_t)v >> 6] >> (v & 63)) & 1; };
+        auto mark = [&](int k, int v, int p) {
+            sc.seen[k][(size_t)v >> 6] |= 1ULL << (v & 63);
+            sc.parent[k][v] = p;
+            sc.visited[k].push_back(v);
+        };
+        int meet = (s == t) ? s : -1;
+        mark(0, s, -1);
+        mark(1, t, -1);
+        sc.frontier[0].assign(1, s);
+        sc.frontier[1].assign(1, t);
+        while (meet == -1 && !sc.frontier[0].empty() && !sc.frontier[1].empty()) {
+            int k = sc.frontier[0].size() <= sc.frontier[1].size() ? 0 : 1;
+            sc.next.clear();
+            for (int u : sc.frontier[k]) {
+                ARBOR_COUNT(path_nodes_settled, 1);
+                for (int v : neighbors(u)) {
+                    if (seen(k, v)) continue;
+                    mark(k, v, u);
+                    ARBOR_COUNT(path_heap_pushes, 1);
+                    if (seen(1 - k, v)) { meet = v; break; }
+                    sc.next.push_back(v);
+                }
+                if (meet != -1) break;
             }
+            sc.frontier[k].swap(sc.next);
         }
-        if (x > maximum) maximum = x;
+        if (meet != -1) {
+            size_t mid = out.size();
+            for (int v = meet; v != -1; v = sc.parent[0][v]) out.push_back(v);
+            reverse(out.begin() + mid, out.end());
+            for (int v = sc.parent[1][meet]; v != -1; v = sc.parent[1][v]) out.push_back(v);
+        }
+        for (int k = 0; k < 2; ++k) {
+            for (int v : sc.visited[k]) sc.seen[k][(size_t)v >> 6] = 0;
+            sc.visited[k].clear();
+        }
+        return meet != -1;
     }
 
-    // Enumerate all keys stored in this VEB (demo only).
-    void enumerate(vector<int>& out) const {
-        if (minimum == -1) return;
-        out.push_back(minimum);
-        if (universe_size <= 2) {
-            if (maximum != -1 && maximum != minimum) out.push_back(maximum);
-            return;
+    // Hop queries between two valid IDs, shared by distance / shortest_path and
+    // the batch queries so every entry point gives (and caches) the same answer:
+    // the path cache, else the tree index, else bidirectional BFS. Weights are
+    // never used. hop_distance returns the distance (-1 if unreachable) and may
+    // use path as scratch; hop_path also appends the s -> t path to out.
+    int hop_distance(int s, int t, Bidi_Scratch& sc, vector<int>& path) const {
+        int d;
+        if (path_cache && path_cache->get(s, t, d, nullptr)) return d;
+        if (tree_ready) {
+            d = tree_distance(s, t);
+            if (path_cache) path_cache->put(s, t, d, nullptr, 0);
+            return d;
         }
-        int ru = (int)ceil(sqrt((double)universe_size));
-        for (int h = 0; h < (int)clusters.size(); ++h) {
-            if (!clusters[h] || clusters[h]->minimum == -1) continue;
-            vector<int> child;
-            clusters[h]->enumerate(child);
-            for (int l : child) out.push_back(h * ru + l);
+        path.clear();
+        d = bidirectional_bfs(s, t, sc, path) ? (int)path.size() - 1 : -1;
+        if (path_cache) path_cache->put(s, t, d, path.data(), path.size());
+        return d;
+    }
+
+    int hop_path(int s, int t, Bidi_Scratch& sc, vector<int>& out) const {
+        int d;
+        if (path_cache && path_cache->get(s, t, d, &out)) return d;
+        size_t before = out.size();
+        bool found = tree_ready ? tree_path(s, t, out) : bidirectional_bfs(s, t, sc, out);
+        d = found ? (int)(out.size() - before) - 1 : -1;
+        if (path_cache) path_cache->put(s, t, d, out.data() + before, out.size() - before);
+        return d;
+    }
+
+    // Hop distances from s to every node into out[0..size()) (-1 = unreachable):
+    // one BFS that uses out itself as the visited marker, so nothing is
+    // allocated per call beyond a reused per-thread queue.
+    void distances_from(int s, int* out) const {
+        int n = size();
+        fill(out, out + n, -1);
+        thread_local vector<int> queue;
+        queue.clear();
+        queue.push_back(s);
+        out[s] = 0;
+        for (size_t i = 0; i < queue.size(); ++i) {
+            int u = queue[i];
+            for (int v : neighbors(u)) if (out[v] == -1) { out[v] = out[u] + 1; queue.push_back(v); }
         }
     }
-};
 
-// ----------------------------- Arbor Porphyriana ------------------------------
-struct Arbor {
-    vector<vector<int>> adj;                    // adjacency list (undirected)
-    unordered_map<string,int> id_of;            // label -> id
-    vector<string> label_of;                    // id -> label
+    // Distances for n (id, id) pairs into out[0..n); -1 for unreachable or invalid
+    // IDs. Work is split across threads; each worker only touches its own scratch.
+    void batch_distances(const pair<int,int>* pairs, size_t n, int* out, int threads = 0) const {
+        int N = size();
+        parallel_for(n, threads, [&](size_t b, size_t e, int) {
+            Bidi_Scratch sc;
+            vector<int> path;
+            for (size_t i = b; i < e; ++i) {
+                int s = pairs[i].first, t = pairs[i].second;
+                bool valid = s >= 0 && t >= 0 && s < N && t < N;
+                out[i] = valid ? hop_distance(s, t, sc, path) : -1;
+            }
+        });
+    }
 
-    unique_ptr<Van_Emde_Boas> veb;              // VEB index
-    int U;                                      // capacity / universe size
+    vector<int> batch_distances(const vector<pair<string,string>>& pairs, int threads = 0) const {
+        vector<pair<int,int>> ids(pairs.size());
+        parallel_for(pairs.size(), threads, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; ++i) ids[i] = {id_of(pairs[i].first), id_of(pairs[i].second)};
+        });
+        vector<int> out(pairs.size());
+        batch_distances(ids.data(), ids.size(), out.data(), threads);
+        return out;
+    }
 
-    explicit Arbor(int universe_size = 128): U(universe_size) {
-        veb = std::make_unique<Van_Emde_Boas>(U);
+    // Paths for n (id, id) pairs. Each worker appends into its own flat buffer,
+    // which are then stitched together; unreachable pairs yield an empty path.
+    Path_Batch batch_paths(const pair<int,int>* pairs, size_t n, int threads = 0) const {
+        int N = size();
+        if (threads <= 0) threads = (int)max(1u, std::thread::hardware_concurrency());
+        vector<vector<int>> local_nodes(threads);
+        Path_Batch res;
+        res.offsets.assign(n + 1, 0);
+        parallel_for(n, threads, [&](size_t b, size_t e, int tid) {
+            Bidi_Scratch sc;
+            vector<int>& buf = local_nodes[tid];
+            for (size_t i = b; i < e; ++i) {
+                size_t before = buf.size();
+                int s = pairs[i].first, t = pairs[i].second;
+                if (s >= 0 && t >= 0 && s < N && t < N) hop_path(s, t, sc, buf);
+                res.offsets[i + 1] = buf.size() - before;  // length for now
+            }
+        });
+        for (size_t i = 0; i < n; ++i) res.offsets[i + 1] += res.offsets[i];
+        res.nodes.reserve(res.offsets[n]);
+        for (auto& buf : local_nodes) res.nodes.insert(res.nodes.end(), buf.begin(), buf.end());
+        return res;
     }
 
-    int ensure_node(const string& label) {
-        auto it = id_of.find(label);
-        if (it != id_of.end()) return it->second;
-        int id = (int)label_of.size();
-        if (id >= U) throw runtime_error("Out of VEB universe capacity. Increase U.");
-        id_of[label] = id;
-        label_of.push_back(label);
-        if ((int)adj.size() <= id) adj.resize(id + 1);
-        veb->insert(id);
-        return id;
+    Path_Batch batch_paths(const vector<pair<string,string>>& pairs, int threads = 0) const {
+        vector<pair<int,int>> ids(pairs.size());
+        for (size_t i = 0; i < pairs.size(); ++i) ids[i] = {id_of(pairs[i].first), id_of(pairs[i].second)};
+        return batch_paths(ids.data(), ids.size(), threads);
     }
 
-    void connect_parent_child(const string& parent, const string& child) {
-        int p = ensure_node(parent);
-        int c = ensure_node(child);
-        adj[p].push_back(c);
-        adj[c].push_back(p);
+    // ------------------------- Weighted shortest paths --------------------------
+    // Dijkstra over the edge weights (1 for edges added without one) using a
+    // radix heap and the epoch-stamped ws. With bidirectional = true it grows a
+    // search from each end, always expanding the smaller heap, and stops once the
+    // two minimum keys sum to at least the best s -> t meeting distance found.
+    // Returns the distance (-1 if unreachable); the path goes to out if given.
+    long long weighted_path(int s, int t, Dijkstra_Workspace& ws, vector<int>* out = nullptr,
+                            bool bidirectional = false) const {
+        return dijkstra<false>(s, t, ws, out, bidirectional);
     }
 
-    // Dijkstra for unit weights (BFS equivalent but kept as requested).
-    vector<int> shortest_path(const string& a, const string& b) const {
-        auto ita = id_of.find(a), itb = id_of.find(b);
-        if (ita == id_of.end() || itb == id_of.end()) return {};
-        int s = ita->second, t = itb->second;
-        int n = (int)label_of.size();
-        const int INF = 1e9;
-        vector<int> dist(n, INF), parent(n, -1);
-        using P = pair<int,int>; // (dist, node)
-        priority_queue<P, vector<P>, greater<P>> pq;
-        dist[s] = 0; pq.push({0, s});
-        while(!pq.empty()){
-            auto [d,u] = pq.top(); pq.pop();
-            if (d != dist[u]) continue;
-            if (u == t) break;
-            for(int v: adj[u]){
-                if (dist[v] > d + 1){
-                    dist[v] = d + 1;
-                    parent[v] = u;
-                    pq.push({dist[v], v});
+    // The search behind weighted_path; Hops = true costs every edge 1.
+    template <bool Hops>
+    long long dijkstra(int s, int t, Dijkstra_Workspace& ws, vector<int>* out, bool bidirectional) const {
+        if (s == t) { if (out) out->assign(1, s); return 0; }
+        ws.begin(size());
+        uint64_t best = UINT64_MAX;
+        int meet = -1;
+        ws.relax(0, s, 0, -1);
+        if (bidirectional) ws.relax(1, t, 0, -1);
+        for (;;) {
+            int k = 0;
+            if (bidirectional) {
+                Radix_Heap& f = ws.side[0].heap;
+                Radix_Heap& b = ws.side[1].heap;
+                if (f.empty() || b.empty()) break;
+                if (best != UINT64_MAX && f.top() + b.top() >= best) break;
+                k = f.size() <= b.size() ? 0 : 1;
+            } else if (ws.side[0].heap.empty()) {
+                break;
+            }
+            auto [d, u] = ws.side[k].heap.pop();
+            if (d != ws.dist(k, u)) continue;  // stale entry
+            ARBOR_COUNT(path_nodes_settled, 1);
+            if (!bidirectional && u == t) { best = d; meet = t; break; }
+            Id_Span nb = neighbors(u);
+            const uint32_t* w = Hops ? nullptr : neighbor_weights(u);
+            for (size_t j = 0; j < nb.size(); ++j) {
+                int v = nb.first[j];
+                uint64_t nd = d + (w ? w[j] : 1);
+                if (nd >= ws.dist(k, v)) continue;
+                ws.relax(k, v, nd, u);
+                ARBOR_COUNT(path_heap_pushes, 1);
+                if (bidirectional) {
+                    uint64_t other = ws.dist(1 - k, v);
+                    if (other != UINT64_MAX && nd + other < best) { best = nd + other; meet = v; }
                 }
             }
         }
-        if (dist[t] == INF) return {};
+        if (meet == -1) return -1;
+        if (out) {
+            out->clear();
+            for (int v = meet; v != -1; v = ws.side[0].parent[v]) out->push_back(v);
+            reverse(out->begin(), out->end());
+            if (bidirectional) for (int v = ws.side[1].parent[meet]; v != -1; v = ws.side[1].parent[v]) out->push_back(v);
+        }
+        return (long long)best;
+    }
+
+    // Weighted distance / path by label (-1 / empty if unknown or unreachable).
+    long long weighted_distance(string_view a, string_view b, bool bidirectional = false) const {
+        int s = id_of(a), t = id_of(b);
+        if (s == -1 || t == -1) return -1;
+        return weighted_path(s, t, thread_workspace(), nullptr, bidirectional);
+    }
+
+    vector<int> weighted_shortest_path(string_view a, string_view b, bool bidirectional = false) const {
         vector<int> path;
-        for (int cur = t; cur != -1; cur = parent[cur]) path.push_back(cur);
-        reverse(path.begin(), path.end());
+        int s = id_of(a), t = id_of(b);
+        if (s != -1 && t != -1) weighted_path(s, t, thread_workspace(), &path, bidirectional);
+        return path;
+    }
+
+    // Fewest-hop path by unit-weight Dijkstra on the engine above, whatever the
+    // edge weights; the reference for the BFS fallback (and the bench baseline).
+    vector<int> shortest_path_dijkstra(int s, int t) const {
+        vector<int> path;
+        dijkstra<true>(s, t, thread_workspace(), &path, false);
         return path;
     }
 
     // Find shortest path with dfs
-    vector<int> shortest_path_dfs(const string& a, const string& b){
-        auto ita = id_of.find(a), itb = id_of.find(b);
-        if (ita == id_of.end() || itb == id_of.end()) return {};
-        int s = ita->second, t = itb->second;
+    vector<int> shortest_path_dfs(string_view a, string_view b){
+        int s = id_of(a), t = id_of(b);
+        if (s == -1 || t == -1) return {};
         vector<int> path, result;
-        vector<bool> visited(label_of.size(), false);
+        vector<bool> visited(size(), false);
 
         // Lambda dfs
         function<bool(int)> dfs = [&](int u) {
@@ -182,7 +3280,7 @@ struct Arbor {
                 result = path;
                 return true;
             }
-            for (int v : adj[u]) {
+            for (int v : neighbors(u)) {
                 if (!visited[v]) {
                     if (dfs(v)) return true;
                 }
@@ -195,30 +3293,533 @@ struct Arbor {
     }
 
     void dump_veb_view() const {
-        cout << "\n--- VEB View (U=" << U << ") ---\n";
-        vector<int> keys; veb->enumerate(keys);
-        sort(keys.begin(), keys.end()); keys.erase(unique(keys.begin(), keys.end()), keys.end());
-        int ru = (int)ceil(sqrt((double)veb->universe_size));
-        vector<vector<int>> by_cluster(ru);
-        for (int k : keys) {
-            int h = veb->high(k);
-            if (h>=0 && h<ru) by_cluster[h].push_back(k);
-        }
-        for (int h = 0; h < ru; ++h) {
-            if (by_cluster[h].empty()) continue;
-            cout << "cluster[" << h << "] -> IDs: ";
-            for (int k : by_cluster[h]) cout << k << ' ';
+        cout << "\n--- VEB View (U=" << U << ", index=" << veb->name() << ") ---\n";
+        // IDs are grouped in fixed-width buckets of ceil(sqrt(U)) keys whatever
+        // the backend (only the sqrt VEB's clusters have that width). Keys come
+        // out of the index in order, so each non-empty bucket is one range
+        // scan; successor() skips straight to the next one.
+        int ru = (int)ceil(sqrt((double)veb->universe()));
+        for (int k = veb->min(); k != -1; ) {
+            int h = k / ru;
+            int end = (int)std::min<long long>((long long)(h + 1) * ru, veb->universe());
+            cout << "bucket[" << h << "] -> IDs: ";
+            veb->for_each_in_range(k, end, [](int id) { cout << id << ' '; });
             cout << "\nlabels: ";
-            for (int k : by_cluster[h]) {
-                if (k >= 0 && k < (int)label_of.size()) cout << label_of[k] << ", ";
-                else cout << "(unused:#" << k << "), ";
-            }
+            veb->for_each_in_range(k, end, [&](int id) {
+                if (id < size()) cout << label_of(id) << ", ";
+                else cout << "(unused:#" << id << "), ";
+            });
             cout << "\n";
+            k = veb->successor(end - 1);
+        }
+        cout << "minID=" << veb->min() << ", maxID=" << veb->max() << "\n";
+    }
+};
+
+// ------------------------------ Concurrent Arbor ------------------------------
+// Read-mostly wrapper with RCU-style versioning. Readers pin the current
+// immutable version through a per-reader epoch slot: two atomic stores and one
+// load, with no locks. Writers are serialized. They stage mutations, then
+// publish() copies the current version, applies the batch, refreezes and swaps
+// the new version in with one atomic exchange. A replaced version is retired
+// with the epoch of its replacement and freed once every active reader pinned at
+// that epoch or later. A publish costs O(n), so writers should batch.
+class Concurrent_Arbor {
+public:
+    // max_readers: reader slots available to register_reader().
+    explicit Concurrent_Arbor(Arbor initial, int max_readers = 64)
+        : slot_count(max(max_readers, 1)), slots(new Reader_Slot[slot_count]) {
+        if (!initial.frozen) initial.freeze();
+        current.store(new Arbor(std::move(initial)));
+    }
+
+    ~Concurrent_Arbor() {
+        delete current.load();
+        for (auto& r : retired) delete r.version;
+    }
+
+    Concurrent_Arbor(const Concurrent_Arbor&) = delete;
+    Concurrent_Arbor& operator=(const Concurrent_Arbor&) = delete;
+
+    // Claims a reader slot (one per reading thread); -1 if all are taken.
+    int register_reader() {
+        for (int i = 0; i < slot_count; ++i) {
+            bool expected = false;
+            if (slots[i].claimed.compare_exchange_strong(expected, true)) return i;
+        }
+        return -1;
+    }
+    void unregister_reader(int slot) { slots[slot].claimed.store(false); }
+
+    // Pins the version current at construction; the Arbor stays valid until
+    // the guard is destroyed. Only one guard per slot may be alive at a time.
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&& o) noexcept: slot(o.slot), arbor(o.arbor) { o.slot = nullptr; }
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot() { if (slot) slot->store(0, memory_order_release); }
+
+        const Arbor& operator*() const { return *arbor; }
+        const Arbor* operator->() const { return arbor; }
+
+    private:
+        friend class Concurrent_Arbor;
+        Snapshot(atomic<uint64_t>* s, const Arbor* a): slot(s), arbor(a) {}
+        atomic<uint64_t>* slot;
+        const Arbor* arbor;
+    };
+
+    Snapshot pin(int slot) const {
+        atomic<uint64_t>& e = slots[slot].epoch;
+        // seq_cst: the epoch store must be visible before current is read, so a
+        // writer that retires what we load also sees us as active.
+        e.store(epoch.load());
+        return Snapshot(&e, current.load());
+    }
+
+    // Queues an edge for the next publish().
+    void stage_edge(string parent, string child) {
+        lock_guard<mutex> lock(write_mu);
+        pending.emplace_back(std::move(parent), std::move(child));
+    }
+
+    // Copies the current version, applies fn (if any) and the staged edges,
+    // refreezes and publishes. Returns the new version's epoch.
+    template <class Fn>
+    uint64_t publish(Fn&& fn) {
+        lock_guard<mutex> lock(write_mu);
+        auto next = make_unique<Arbor>(*current.load());
+        fn(*next);
+        for (auto& e : pending) next->connect_parent_child(e.first, e.second);
+        pending.clear();
+        if (!next->frozen) next->freeze();
+        Arbor* old = current.exchange(next.release());
+        uint64_t e = epoch.fetch_add(1) + 1;
+        retired.push_back({old, e});
+        reclaim();
+        return e;
+    }
+    uint64_t publish() { return publish([](Arbor&) {}); }
+
+    uint64_t version() const { return epoch.load(); }
+
+    // Frees retired versions no reader can still hold; also run by publish().
+    size_t reclaim_retired() {
+        lock_guard<mutex> lock(write_mu);
+        reclaim();
+        return retired.size();
+    }
+
+private:
+    struct alignas(64) Reader_Slot {
+        atomic<uint64_t> epoch{0};    // 0 = not reading
+        atomic<bool> claimed{false};
+    };
+    struct Retired {
+        Arbor* version;
+        uint64_t epoch;               // epoch at which it was replaced
+    };
+
+    atomic<Arbor*> current{nullptr};
+    atomic<uint64_t> epoch{1};
+    int slot_count;
+    unique_ptr<Reader_Slot[]> slots;
+    mutex write_mu;                   // writers only
+    vector<pair<string,string>> pending;
+    vector<Retired> retired;
+
+    void reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (int i = 0; i < slot_count; ++i) {
+            uint64_t e = slots[i].epoch.load();
+            if (e) oldest = min(oldest, e);
+        }
+        size_t kept = 0;
+        for (auto& r : retired) {
+            if (r.epoch <= oldest) delete r.version;
+            else retired[kept++] = r;
+        }
+        retired.resize(kept);
+    }
+};
+
+// ------------------------------ Binary snapshot --------------------------------
+// Versioned, native-endian image of a frozen Arbor. Every section is 64-byte
+// aligned raw array data, so Mapped_Arbor can answer queries straight from
+// the mapping without copying or parsing:
+//   header | label arena | label offsets | hash slots | CSR offsets | CSR nbrs |
+//   child_begin | child_end | parent | depth | up | VEB bitmap (1 bit per ID < U)
+enum Snapshot_Section { S_ARENA, S_LABEL_OFFS, S_SLOTS, S_CSR_OFFS, S_CSR_NBRS, S_CHILD_BEGIN,
+                        S_CHILD_END, S_PARENT, S_DEPTH, S_UP, S_VEB, S_COUNT };
+
+struct Snapshot_Header {
+    char magic[8];                // "ARBORSNP"
+    uint32_t version;             // SNAPSHOT_VERSION
+    uint32_t byte_order;          // 0x01020304 as written by the producer
+    uint64_t n;                   // number of concepts
+    uint64_t universe;            // VEB universe U
+    uint64_t edge_count;
+    uint32_t log;                 // binary lifting width (0 if no tree index)
+    uint32_t tree_ready;
+    uint64_t section[S_COUNT][2]; // (offset, bytes) per section
+};
+
+static constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+// Writes A (frozen first if needed) to path. Returns false on I/O failure.
+// Edge weights are not part of format version 1.
+bool save_snapshot(Arbor& A, const string& path){
+    if (!A.frozen) A.freeze();
+    vector<uint64_t> bitmap(((size_t)A.U + 63) / 64, 0);
+    A.veb->for_each([&](int k) { bitmap[(size_t)k >> 6] |= 1ULL << (k & 63); });
+
+    const void* src[S_COUNT] = {
+        A.labels.arena.data(), A.labels.offsets.data(), A.labels.slots.data(),
+        A.csr.offsets.data(), A.csr.nbrs.data(), A.csr.child_begin.data(), A.csr.child_end.data(),
+        A.parent_of.data(), A.depth.data(), A.up.data(), bitmap.data()};
+    size_t bytes[S_COUNT] = {
+        A.labels.arena.size(), A.labels.offsets.size() * sizeof(uint64_t),
+        A.labels.slots.size() * sizeof(Label_Interner::Slot),
+        A.csr.offsets.size() * sizeof(int), A.csr.nbrs.size() * sizeof(int),
+        A.csr.child_begin.size() * sizeof(int), A.csr.child_end.size() * sizeof(int),
+        A.parent_of.size() * sizeof(int),
+        A.tree_ready ? A.depth.size() * sizeof(int) : 0, A.tree_ready ? A.up.size() * sizeof(int) : 0,
+        bitmap.size() * sizeof(uint64_t)};
+
+    Snapshot_Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "ARBORSNP", 8);
+    h.version = SNAPSHOT_VERSION;
+    h.byte_order = 0x01020304;
+    h.n = (uint64_t)A.size();
+    h.universe = (uint64_t)A.U;
+    h.edge_count = (uint64_t)A.edge_count;
+    h.log = A.tree_ready ? (uint32_t)A.LOG : 0;
+    h.tree_ready = A.tree_ready;
+    uint64_t pos = (sizeof(h) + 63) & ~63ULL;
+    for (int i = 0; i < S_COUNT; ++i) {
+        h.section[i][0] = pos;
+        h.section[i][1] = bytes[i];
+        pos = (pos + bytes[i] + 63) & ~63ULL;
+    }
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) { cerr << "[snapshot] cannot open: " << path << "\n"; return false; }
+    static const char zeros[64] = {};
+    out.write((const char*)&h, sizeof(h));
+    uint64_t at = sizeof(h);
+    for (int i = 0; i < S_COUNT; ++i) {
+        out.write(zeros, (streamsize)(h.section[i][0] - at));
+        if (bytes[i]) out.write((const char*)src[i], (streamsize)bytes[i]);
+        at = h.section[i][0] + bytes[i];
+    }
+    return (bool)out;
+}
+
+// Read-only Arbor served directly from a mapped snapshot file.
+class Mapped_Arbor {
+public:
+    // Maps path and validates it; false if missing, truncated, foreign or
+    // inconsistent. Every section must lie inside the file and have exactly the
+    // size its counts in the header imply, and the label table must be a power
+    // of two with a free slot and in-range IDs (so a probe always terminates).
+    // One pass over the other arrays then checks everything a query indexes
+    // with or walks (O(n + m + table), the file's size): offsets monotonic,
+    // children inside their node's run, neighbors and parents in range, and
+    // the tree index exactly as build_tree_index would have built it.
+    bool open(const string& path) {
+        if (!file.open(path)) { cerr << "[snapshot] cannot open: " << path << "\n"; return false; }
+        if (file.size < sizeof(Snapshot_Header)) return fail("truncated header");
+        memcpy(&h, file.data, sizeof(h));
+        if (memcmp(h.magic, "ARBORSNP", 8) != 0) return fail("bad magic");
+        if (h.byte_order != 0x01020304) return fail("byte order mismatch");
+        if (h.version != SNAPSHOT_VERSION) return fail("unsupported version");
+        for (int i = 0; i < S_COUNT; ++i) {
+            uint64_t off = h.section[i][0], len = h.section[i][1];
+            if (off % 8 || off > file.size || len > file.size - off) return fail("bad section table");
+        }
+        if (h.n >= (uint64_t)INT_MAX || h.universe > (uint64_t)INT_MAX || h.universe < h.n ||
+            h.edge_count > (uint64_t)INT_MAX / 2) return fail("bad counts");
+        if (h.tree_ready ? (h.log < 1 || h.log > 31) : h.log != 0) return fail("bad tree index width");
+        uint64_t n = h.n, tree_n = h.tree_ready ? n : 0;
+        const uint64_t want[S_COUNT] = {
+            h.section[S_ARENA][1], (n + 1) * sizeof(uint64_t), h.section[S_SLOTS][1],
+            (n + 1) * sizeof(int), 2 * h.edge_count * sizeof(int), n * sizeof(int), n * sizeof(int),
+            n * sizeof(int), tree_n * sizeof(int), tree_n * h.log * sizeof(int),
+            (h.universe + 63) / 64 * sizeof(uint64_t)};
+        for (int i = 0; i < S_COUNT; ++i) if (h.section[i][1] != want[i]) return fail("section size mismatch");
+        arena = section<char>(S_ARENA);
+        label_offs = section<uint64_t>(S_LABEL_OFFS);
+        slots = section<Label_Interner::Slot>(S_SLOTS);
+        slot_count = h.section[S_SLOTS][1] / sizeof(Label_Interner::Slot);
+        csr_offs = section<int>(S_CSR_OFFS);
+        csr_nbrs = section<int>(S_CSR_NBRS);
+        child_begin = section<int>(S_CHILD_BEGIN);
+        child_end = section<int>(S_CHILD_END);
+        tree = {section<int>(S_PARENT), section<int>(S_DEPTH), section<int>(S_UP), (int)h.log};
+        veb_words = section<uint64_t>(S_VEB);
+        if (label_offs[0] != 0 || label_offs[n] != h.section[S_ARENA][1]) return fail("bad label offsets");
+        if ((uint64_t)csr_offs[0] != 0 || (uint64_t)csr_offs[n] != 2 * h.edge_count) return fail("bad CSR offsets");
+        if (h.section[S_SLOTS][1] % sizeof(Label_Interner::Slot) || slot_count == 0 ||
+            (slot_count & (slot_count - 1)) || slot_count <= n) return fail("bad label table size");
+        bool free_slot = false;
+        for (size_t i = 0; i < slot_count; ++i) {
+            if (slots[i].id < -1 || slots[i].id >= (int64_t)n) return fail("bad label table entry");
+            free_slot |= slots[i].id == -1;
+        }
+        if (!free_slot) return fail("label table full");
+        for (uint64_t u = 0; u < n; ++u) {
+            if (label_offs[u] > label_offs[u + 1]) return fail("bad label offsets");
+            if (csr_offs[u] > csr_offs[u + 1]) return fail("bad CSR offsets");
+            if (child_begin[u] < csr_offs[u] || child_begin[u] > child_end[u] || child_end[u] > csr_offs[u + 1])
+                return fail("bad child range");
+            if (tree.parent[u] < -1 || tree.parent[u] >= (int64_t)n) return fail("bad parent");
+        }
+        for (uint64_t i = 0; i < 2 * h.edge_count; ++i) {
+            if (csr_nbrs[i] < 0 || csr_nbrs[i] >= (int64_t)n) return fail("bad CSR neighbor");
+        }
+        // Depth one below the parent (0 for roots) and under 2^log, and every
+        // ancestor row the doubling of the one before: then lca() only lands on
+        // real ancestors and path() never walks past a root.
+        for (uint64_t v = 0; v < tree_n; ++v) {
+            int p = tree.parent[v], d = tree.depth[v];
+            if (d < 0 || (int64_t)d >= (int64_t)1 << h.log || d != (p == -1 ? 0 : (int64_t)tree.depth[p] + 1))
+                return fail("bad tree depth");
+            const int* row = tree.up + v * h.log;
+            if (row[0] != (p == -1 ? (int)v : p)) return fail("bad tree ancestor");
+            for (uint64_t k = 1; k < h.log; ++k) {
+                if (row[k] < 0 || row[k] >= (int64_t)n) return fail("bad tree ancestor");
+                if (row[k] != tree.up[(uint64_t)row[k - 1] * h.log + k - 1]) return fail("bad tree ancestor");
+            }
+        }
+        return true;
+    }
+
+    inline int size() const { return (int)h.n; }
+    inline int universe() const { return (int)h.universe; }
+    inline bool tree_ready() const { return h.tree_ready != 0; }
+
+    inline int id_of(string_view label) const {
+        return Label_Interner::probe(slots, slot_count, arena, label_offs, label, Label_Interner::hash_of(label));
+    }
+    inline string_view label_of(int id) const {
+        return string_view(arena + label_offs[id], (size_t)(label_offs[id + 1] - label_offs[id]));
+    }
+    inline int parent(int id) const { return tree.parent[id]; }
+    inline Id_Span neighbors(int u) const { return {csr_nbrs + csr_offs[u], csr_nbrs + csr_offs[u + 1]}; }
+    inline Id_Span children(int u) const { return {csr_nbrs + child_begin[u], csr_nbrs + child_end[u]}; }
+    inline bool contains(int id) const {
+        return id >= 0 && id < universe() && ((veb_words[(size_t)id >> 6] >> (id & 63)) & 1);
+    }
+
+    inline const Tree_Tables& tables() const { return tree; }
+
+    // Hop distance by label (-1 if unknown or unreachable).
+    int distance(string_view a, string_view b) const {
+        int s = id_of(a), t = id_of(b);
+        if (s == -1 || t == -1) return -1;
+        if (tree_ready()) return tree.distance(s, t);
+        vector<int> path = bfs(s, t);
+        return path.empty() ? -1 : (int)path.size() - 1;
+    }
+
+    vector<int> shortest_path(string_view a, string_view b) const {
+        int s = id_of(a), t = id_of(b);
+        if (s == -1 || t == -1) return {};
+        if (!tree_ready()) return bfs(s, t);
+        vector<int> path;
+        tree.path(s, t, path);
+        return path;
+    }
+
+private:
+    Mapped_File file;
+    Snapshot_Header h{};
+    const char* arena = nullptr;
+    const uint64_t* label_offs = nullptr;
+    const Label_Interner::Slot* slots = nullptr;
+    size_t slot_count = 0;
+    const int* csr_offs = nullptr;
+    const int* csr_nbrs = nullptr;
+    const int* child_begin = nullptr;
+    const int* child_end = nullptr;
+    Tree_Tables tree{};
+    const uint64_t* veb_words = nullptr;
+
+    template <class T> const T* section(int i) const { return (const T*)(file.data + h.section[i][0]); }
+
+    bool fail(const char* why) {
+        cerr << "[snapshot] " << why << "\n";
+        file.close();
+        return false;
+    }
+
+    // Fallback for snapshots of graphs that are not forests.
+    vector<int> bfs(int s, int t) const {
+        vector<int> parent(size(), -2), queue{s};
+        parent[s] = -1;
+        for (size_t i = 0; i < queue.size() && parent[t] == -2; ++i) {
+            for (int v : neighbors(queue[i])) if (parent[v] == -2) { parent[v] = queue[i]; queue.push_back(v); }
         }
-        cout << "minID=" << veb->minimum << ", maxID=" << veb->maximum << "\n";
+        if (parent[t] == -2) return {};
+        vector<int> path;
+        for (int cur = t; cur != -1; cur = parent[cur]) path.push_back(cur);
+        reverse(path.begin(), path.end());
+        return path;
     }
 };
 
+// ------------------------------ Distance matrix -------------------------------
+// File layout written by write_distance_matrix: this header, then the n x n
+// int32 matrix (row-major, -1 = unreachable) at data_offset.
+struct Distance_Matrix_Header {
+    char magic[8];        // "ARBORAPD"
+    uint32_t version;     // DISTANCE_MATRIX_VERSION
+    uint32_t byte_order;  // 0x01020304 as written by the producer
+    uint64_t n;
+    uint64_t data_offset; // 64
+    uint8_t pad[32];
+};
+static_assert(sizeof(Distance_Matrix_Header) == 64, "header is one cache line");
+
+static constexpr uint32_t DISTANCE_MATRIX_VERSION = 1;
+
+// Writes all pairwise hop distances of A to path through a memory-mapped file.
+// With the tree index, the matrix is split into tile x tile blocks. Only the
+// blocks on or above the diagonal are computed (by LCA), each written with its
+// transpose, and blocks are shared out across threads. Without the index (or
+// with bfs_rows, e.g. to compare the two) each row is one BFS. Returns false
+// on I/O failure or if tile is not positive.
+bool write_distance_matrix(const Arbor& A, const string& path, int threads = 0, int tile = 256,
+                           bool bfs_rows = false){
+    if (tile <= 0) { cerr << "[apsp] tile must be positive: " << tile << "\n"; return false; }
+    size_t n = (size_t)A.size();
+    size_t bytes = sizeof(Distance_Matrix_Header) + n * n * sizeof(int32_t);
+    Mapped_Output out;
+    if (!out.create(path, bytes)) { cerr << "[apsp] cannot create: " << path << "\n"; return false; }
+    Distance_Matrix_Header h{};
+    memcpy(h.magic, "ARBORAPD", 8);
+    h.version = DISTANCE_MATRIX_VERSION;
+    h.byte_order = 0x01020304;
+    h.n = n;
+    h.data_offset = sizeof(Distance_Matrix_Header);
+    memcpy(out.data, &h, sizeof(h));
+    int32_t* m = (int32_t*)(out.data + h.data_offset);
+
+    if (!A.tree_ready || bfs_rows) {
+        parallel_for(n, threads, [&](size_t b, size_t e, int) {
+            for (size_t r = b; r < e; ++r) A.distances_from((int)r, m + r * n);
+        });
+        return out.close();
+    }
+
+    size_t T = (n + (size_t)tile - 1) / (size_t)tile;
+    vector<pair<uint32_t,uint32_t>> blocks;
+    blocks.reserve(T * (T + 1) / 2);
+    for (size_t bi = 0; bi < T; ++bi) for (size_t bj = bi; bj < T; ++bj) blocks.push_back({(uint32_t)bi, (uint32_t)bj});
+    // Interleave blocks over workers so each gets a mix of long and short rows.
+    int workers = threads > 0 ? threads : (int)max(1u, std::thread::hardware_concurrency());
+    Tree_Tables tt = A.tables();
+    parallel_for((size_t)workers, workers, [&](size_t wb, size_t we, int) {
+        for (size_t w = wb; w < we; ++w) {
+            for (size_t k = w; k < blocks.size(); k += (size_t)workers) {
+                size_t i0 = (size_t)blocks[k].first * tile, i1 = min(n, i0 + tile);
+                size_t j0 = (size_t)blocks[k].second * tile, j1 = min(n, j0 + tile);
+                for (size_t i = i0; i < i1; ++i) {
+                    for (size_t j = max(j0, i); j < j1; ++j) {
+                        int32_t d = tt.distance((int)i, (int)j);
+                        m[i * n + j] = d;
+                        m[j * n + i] = d;
+                    }
+                }
+            }
+        }
+    });
+    return out.close();
+}
+
+// ------------------------------- Bulk loader ---------------------------------
+// Loads "parent<TAB>child" (or "parent,child") lines from a file. The file is
+// memory-mapped and split at line boundaries into one chunk per thread; each
+// worker parses its chunk into label views and hashes them. A single pass then
+// interns the labels with the precomputed hashes and adds the edges in file
+// order, so IDs come out exactly as repeated connect_parent_child calls would
+// assign them. Blank lines and lines starting with '#' are skipped; CSV
+// quoting is not supported. Returns the number of edges added, or -1 if the
+// file cannot be read.
+long long load_edges_file(Arbor& A, const string& path, int threads = 0){
+    ARBOR_TIMER(load_edges);
+    ARBOR_ALLOC_SCOPE(load_edges);
+    Mapped_File file;
+    if (!file.open(path)) { cerr << "[loader] cannot open: " << path << "\n"; return -1; }
+    const char* data = file.data;
+    size_t size = file.size;
+    if (threads <= 0) threads = (int)max(1u, std::thread::hardware_concurrency());
+    threads = (int)max<size_t>(1, min<size_t>((size_t)threads, size / (1 << 16) + 1));
+
+    // Chunk boundaries, each just past a newline.
+    vector<size_t> cut(threads + 1, size);
+    cut[0] = 0;
+    for (int t = 1; t < threads; ++t) {
+        size_t at = max(cut[t - 1], size * t / threads);
+        const char* nl = (const char*)memchr(data + at, '\n', size - at);
+        cut[t] = nl ? (size_t)(nl - data) + 1 : size;
+    }
+
+    struct Edge_Ref {
+        string_view parent, child;
+        uint32_t hp, hc;
+    };
+    vector<vector<Edge_Ref>> parsed(threads);
+    vector<size_t> malformed(threads, 0);
+    parallel_for((size_t)threads, threads, [&](size_t b, size_t e, int) {
+        for (size_t t = b; t < e; ++t) {
+            const char* p = data + cut[t];
+            const char* end = data + cut[t + 1];
+            vector<Edge_Ref>& out = parsed[t];
+            out.reserve((size_t)(end - p) / 16);
+            while (p < end) {
+                const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+                const char* eol = nl ? nl : end;
+                const char* line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+                if (line_end > p && *p != '#') {
+                    size_t len = (size_t)(line_end - p);
+                    const char* sep = (const char*)memchr(p, '\t', len);
+                    if (!sep) sep = (const char*)memchr(p, ',', len);
+                    if (sep && sep > p && sep + 1 < line_end) {
+                        string_view par(p, (size_t)(sep - p)), chi(sep + 1, (size_t)(line_end - sep - 1));
+                        out.push_back({par, chi, Label_Interner::hash_of(par), Label_Interner::hash_of(chi)});
+                    } else {
+                        ++malformed[t];
+                    }
+                }
+                p = eol + 1;
+            }
+        }
+    });
+
+    size_t total = 0, bad = 0;
+    for (int t = 0; t < threads; ++t) { total += parsed[t].size(); bad += malformed[t]; }
+    if (bad) cerr << "[loader] skipped " << bad << " malformed line(s) in " << path << "\n";
+    // A tree with total edges has total + 1 labels, so a taxonomy import never
+    // regrows the tables; inputs with more labels (disjoint pairs) grow them by
+    // doubling instead of every import paying for two labels per edge. The ID
+    // index is sized once, for the labels actually added, by sync_index().
+    A.reserve(A.size() + (int)min<size_t>(total + 1, INT_MAX / 2), /*size_index=*/false);
+    A.defer_index();
+    for (const auto& chunk : parsed) {
+        for (const Edge_Ref& e : chunk) {
+            // Parent first, as connect_parent_child assigns them.
+            int p = A.ensure_node(e.parent, e.hp);
+            int c = A.ensure_node(e.child, e.hc);
+            A.connect_ids(p, c);
+        }
+    }
+    A.sync_index();
+    return (long long)total;
+}
+
 // ----------------------------- Sample Builders -------------------------------
 void build_sample_animals(Arbor& A){
     A.connect_parent_child("substance", "body");
@@ -293,78 +3894,303 @@ void build_sample_students(Arbor& A){
 
 
 // Synthetic N-level Porphyrian-style tree with branching factor B.
+// Nodes are labelled "L<level>_<index>" and created level by level. The node
+// count (B^levels - 1) / (B - 1) is known up front, so everything is reserved
+// once; parents are addressed by ID and each label is formatted in place with
+// a single to_chars. On an empty Arbor the IDs are assigned arithmetically (no
+// label lookups at all); otherwise labels go through ensure_node as before.
+// The ID index is filled once at the end (Arbor::defer_index).
 void build_synthetic_porhyry(Arbor& A, int levels, int B){
     if (levels <= 0) return;
-    vector<string> prev;
-    string root = "L1_0";
-    A.ensure_node(root);
-    prev.push_back(root);
+    if (B <= 0) levels = 1;   // the root alone, as before
+    ARBOR_ALLOC_SCOPE(build_synthetic);
+    long long total = 0, width = 1, widest = 1;
+    for (int lvl = 1; lvl <= levels; ++lvl, width *= B) {
+        total += width;
+        widest = width;
+        if (total > INT_MAX) throw runtime_error("Synthetic tree too large for 32-bit IDs.");
+    }
+    int digits = (int)to_string(widest).size() + (int)to_string(levels).size() + 2;
+    bool fresh = (A.size() == 0);
+    A.reserve(A.size() + (int)total);
+    A.labels.arena.reserve(A.labels.arena.size() + (size_t)total * digits);
+
+    char name[48];
+    auto format = [&](int lvl, long long idx) {
+        char* p = name;
+        *p++ = 'L';
+        p = to_chars(p, p + 16, lvl).ptr;
+        *p++ = '_';
+        p = to_chars(p, p + 24, idx).ptr;
+        return string_view(name, (size_t)(p - name));
+    };
+    auto node = [&](string_view label) {
+        uint32_t h = Label_Interner::hash_of(label);
+        return fresh ? A.add_new_node(label, h) : A.ensure_node(label, h);
+    };
+
+    vector<int> prev, cur;          // level IDs, only needed when not fresh
+    A.defer_index();
+    int prev_first = node(format(1, 0));
+    if (!fresh) prev.push_back(prev_first);
+    long long prev_count = 1;
     for (int lvl = 2; lvl <= levels; ++lvl) {
-        vector<string> cur;
-        for (const string& p : prev) {
-            for (int b = 0; b < B; ++b) {
-                string name = string("L") + to_string(lvl) + "_" + to_string((int)cur.size());
-                A.connect_parent_child(p, name);
-                cur.push_back(name);
-            }
+        long long count = prev_count * B;
+        int first = A.size();
+        for (long long j = 0; j < count; ++j) {
+            int p = fresh ? prev_first + (int)(j / B) : prev[(size_t)(j / B)];
+            int c = node(format(lvl, j));
+            A.connect_ids(p, c);
+            if (!fresh) cur.push_back(c);
         }
+        prev_first = first;
+        prev_count = count;
         prev.swap(cur);
+        cur.clear();
     }
+    A.sync_index();
 }
 
 // ------------------------------ Diagram Utils --------------------------------
-static string join_labels(const vector<int>& ids, const vector<string>& labels, const string& sep = " -> "){
+string join_labels(const vector<int>& ids, const Arbor& A, const string& sep = " -> "){
     string out;
     for (size_t i=0;i<ids.size();++i){
         int id = ids[i];
-        out += (id>=0 && id<(int)labels.size()) ? labels[id] : (string("#")+to_string(id));
+        if (id>=0 && id<A.size()) out += A.label_of(id);
+        else out += string("#")+to_string(id);
         if (i+1<ids.size()) out += sep;
     }
     return out;
 }
 
+// Large-buffer output sink: collects bytes and hands them to the stream in
+// big blocks, so per-line formatting never goes through ostream machinery.
+class Buffered_Writer {
+public:
+    explicit Buffered_Writer(ostream& os, size_t capacity = 1 << 20): out(os), cap(capacity) {
+        buf.reserve(cap);
+    }
+    ~Buffered_Writer() { flush(); }
+
+    inline void put(char c) {
+        if (buf.size() == cap) flush();
+        buf.push_back(c);
+    }
+    inline void write(string_view s) {
+        if (buf.size() + s.size() > cap) {
+            flush();
+            if (s.size() > cap) { out.write(s.data(), (streamsize)s.size()); total += s.size(); return; }
+        }
+        buf.insert(buf.end(), s.begin(), s.end());
+    }
+    inline void write_int(long long v) {
+        char tmp[24];
+        auto r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+        write(string_view(tmp, (size_t)(r.ptr - tmp)));
+    }
+    void flush() {
+        if (buf.empty()) return;
+        out.write(buf.data(), (streamsize)buf.size());
+        total += buf.size();
+        buf.clear();
+    }
+    size_t bytes_written() const { return total + buf.size(); }
+
+private:
+    ostream& out;
+    size_t cap;
+    vector<char> buf;
+    size_t total = 0;
+};
+
 // ASCII tree printing from a chosen root label (ASCII-only connectors).
-void print_ascii_tree_from_root(const Arbor& A, const string& root_lbl){
-    auto it = A.id_of.find(root_lbl);
-    if (it == A.id_of.end()) { cerr << "[diagram] root label not found: " << root_lbl << "\n"; return; }
-    int root = it->second;
-
-    function<void(int,int,string,bool)> dfs = [&](int u, int parent, string prefix, bool last){
-        cout << prefix;
-        if (!prefix.empty()) cout << (last ? "+-" : "+-");
-        cout << A.label_of[u] << "\n";
-
-        vector<int> children = A.adj[u];
-        if (parent != -1) children.erase(remove(children.begin(), children.end(), parent), children.end());
-        for (size_t i=0;i<children.size();++i){
-            bool is_last = (i+1==children.size());
-            string next_prefix = prefix + (prefix.empty()? "" : (last? "  " : "| "));
-            dfs(children[i], u, next_prefix, is_last);
+// Prints the parent_of subtree of the root, the same frozen or not: a node's
+// children are the neighbours whose parent it is (each once), so cross-links
+// and the root's own ancestors are not followed.
+// Iterative DFS with an explicit stack and a single shared prefix buffer, so
+// depth is limited only by memory. max_depth >= 0 stops expanding below that
+// depth (hidden children are shown as "[+k]"); max_nodes > 0 stops after that
+// many lines.
+void print_ascii_tree_from_root(const Arbor& A, string_view root_lbl,
+                                int max_depth = -1, size_t max_nodes = 0, ostream& os = cout){
+    int root = A.id_of(root_lbl);
+    if (root == -1) { cerr << "[diagram] root label not found: " << root_lbl << "\n"; return; }
+
+    struct Frame {
+        int node;           // node whose children are being listed
+        Id_Span kids;       // children (frozen) or all neighbours (not frozen)
+        const int* next;    // next entry of kids to visit
+        size_t remaining;   // children still to visit
+        size_t prefix_len;  // prefix length to restore when the frame is popped
+    };
+    // Not frozen, children are picked out of adj as freeze() does: v is a child
+    // of u if parent_of[v] == u and v is not u's own parent (a 2-cycle). seen[v]
+    // is u once v is counted and -2 - u once it is printed, so duplicate edges
+    // are skipped.
+    vector<int> seen(A.frozen ? 0 : (size_t)A.size(), -1);
+    auto is_child = [&](int u, int v) { return A.parent_of[v] == u && v != A.parent_of[u]; };
+    auto child_count = [&](int u, Id_Span kids) {
+        if (A.frozen) return kids.size();
+        size_t n = 0;
+        for (int v : kids) if (is_child(u, v) && seen[v] != u) { seen[v] = u; ++n; }
+        return n;
+    };
+    auto take = [&](int u, int v) {
+        if (A.frozen) return true;
+        if (!is_child(u, v) || seen[v] != u) return false;
+        seen[v] = -2 - u;
+        return true;
+    };
+    auto kids_of = [&](int u) { return A.frozen ? A.children(u) : A.neighbors(u); };
+
+    Buffered_Writer w(os);
+    string prefix;
+    vector<Frame> stack;
+    size_t printed = 0;
+
+    // Prints u at the given depth and, if it is to be expanded, pushes its frame.
+    auto visit = [&](int u, int depth, bool last) {
+        if (depth > 0) { w.write(prefix); w.write("+-"); }
+        w.write(A.label_of(u));
+        ++printed;
+        Id_Span kids = kids_of(u);
+        size_t n = child_count(u, kids);
+        if (n && max_depth >= 0 && depth >= max_depth) {
+            w.write(" [+"); w.write_int((long long)n); w.put(']');
+            n = 0;
         }
+        w.put('\n');
+        if (!n) return;
+        size_t saved = prefix.size();
+        if (depth > 0) prefix += last ? "  " : "| ";
+        stack.push_back({u, kids, kids.begin(), n, saved});
     };
 
-    dfs(root, -1, "", true);
+    visit(root, 0, true);
+    for (;;) {
+        // Finished frames go first: a tree of exactly max_nodes nodes is complete.
+        while (!stack.empty() && stack.back().remaining == 0) {
+            prefix.resize(stack.back().prefix_len);
+            stack.pop_back();
+        }
+        if (stack.empty()) break;
+        if (max_nodes && printed >= max_nodes) {
+            w.write("... (truncated after "); w.write_int((long long)printed); w.write(" nodes)\n");
+            break;
+        }
+        Frame& f = stack.back();
+        int v = *f.next++;
+        if (!take(f.node, v)) continue;
+        bool last = (--f.remaining == 0);
+        visit(v, (int)stack.size(), last);  // may grow the stack; f is not used after
+    }
+}
+
+// Graphviz export options. Depth limits and sharding need the tree index
+// (freeze() / build_tree_index()); without it they are ignored.
+struct Graphviz_Options {
+    int max_depth = -1;              // emit only nodes with depth <= K (-1 = all)
+    int shard_depth = -1;            // >= 0: every node at this depth gets its own
+                                     // "<base>_<id>.dot" holding its subtree
+    size_t buffer_bytes = 1 << 22;   // output buffer per file
+};
+
+static void write_dot_label(Buffered_Writer& w, string_view label){
+    for (char c : label) {
+        if (c == '"' || c == '\\') w.put('\\');
+        w.put(c);
+    }
 }
 
-// Graphviz DOT emitter (undirected). Writes to porphyry.dot
-void emit_graphviz(const Arbor& A, const string& filename){
-    ofstream ofs(filename);
-    if (!ofs) { cerr << "[graphviz] cannot open: " << filename << "\n"; return; }
-    ofs << "graph Porphyry {\n";
-    ofs << "  rankdir=TB;\n";
-    ofs << "  node [shape=box, style=rounded];\n";
+// Writes one DOT file with the given nodes. If tree_edges, an edge is emitted
+// from each node to its parent (except for `top`); otherwise all u<v neighbour
+// pairs are written. Returns bytes written, or 0 on failure.
+static size_t write_dot_file(const Arbor& A, const string& filename, const vector<int>* nodes,
+                             bool tree_edges, int top, size_t buffer_bytes){
+    ofstream ofs(filename, ios::binary);
+    if (!ofs) { cerr << "[graphviz] cannot open: " << filename << "\n"; return 0; }
+    Buffered_Writer w(ofs, buffer_bytes);
+    w.write("graph Porphyry {\n  rankdir=TB;\n  node [shape=box, style=rounded];\n");
+    size_t n = nodes ? nodes->size() : (size_t)A.size();
     // Declare nodes
-    for (size_t i=0;i<A.label_of.size();++i){
-        ofs << "  n" << i << " [label=\"" << A.label_of[i] << "\"];\n";
+    for (size_t i = 0; i < n; ++i) {
+        int v = nodes ? (*nodes)[i] : (int)i;
+        w.write("  n"); w.write_int(v); w.write(" [label=\"");
+        write_dot_label(w, A.label_of(v));
+        w.write("\"];\n");
+    }
+    // Undirected edges, avoid duplicates by u<v (or one edge per child)
+    for (size_t i = 0; i < n; ++i) {
+        int u = nodes ? (*nodes)[i] : (int)i;
+        if (tree_edges) {
+            int p = A.parent_of[u];
+            if (p == -1 || u == top) continue;
+            w.write("  n"); w.write_int(p); w.write(" -- n"); w.write_int(u); w.write(";\n");
+            continue;
+        }
+        for (int v : A.neighbors(u)) if (u < v) {
+            w.write("  n"); w.write_int(u); w.write(" -- n"); w.write_int(v); w.write(";\n");
+        }
     }
-    // Undirected edges, avoid duplicates by u<v
-    for (size_t u=0; u<A.adj.size(); ++u){
-        for (int v : A.adj[u]) if ((int)u < v){
-            ofs << "  n" << u << " -- n" << v << ";\n";
+    w.write("}\n");
+    w.flush();
+    return ofs ? w.bytes_written() : 0;
+}
+
+// Graphviz DOT emitter (undirected). Writes to porphyry.dot (plus shard files
+// when requested) and returns the list of files written.
+vector<string> emit_graphviz(const Arbor& A, const string& filename, const Graphviz_Options& opt = {}){
+    ARBOR_TIMER(emit_graphviz);
+    vector<string> files;
+    bool limited = opt.max_depth >= 0 || opt.shard_depth >= 0;
+    if (limited && !A.tree_ready) {
+        cerr << "[graphviz] depth/shard options need the tree index (call freeze()); writing full graph\n";
+        limited = false;
+    }
+    if (!limited) {
+        size_t bytes = write_dot_file(A, filename, nullptr, false, -1, opt.buffer_bytes);
+        ARBOR_COUNT(graphviz_bytes, bytes);
+        if (!bytes) return files;
+        files.push_back(filename);
+        cerr << "[graphviz] wrote " << filename << " (" << bytes << " bytes; render with: dot -Tpng " << filename << " -o porphyry.png)\n";
+        return files;
+    }
+
+    int k = (opt.max_depth >= 0) ? opt.max_depth : INT_MAX;
+    int top_depth = (opt.shard_depth >= 0) ? min(opt.shard_depth, k) : k;
+    vector<int> top, shard_roots;
+    for (int v = 0; v < A.size(); ++v) {
+        if (A.depth[v] <= top_depth) top.push_back(v);
+        if (A.depth[v] == opt.shard_depth && opt.shard_depth < k) shard_roots.push_back(v);
+    }
+    size_t total = write_dot_file(A, filename, &top, true, -1, opt.buffer_bytes);
+    if (!total) return files;
+    files.push_back(filename);
+
+    string base = filename;
+    if (base.size() > 4 && base.compare(base.size() - 4, 4, ".dot") == 0) base.resize(base.size() - 4);
+    vector<int> sub, stack;
+    for (int r : shard_roots) {
+        sub.clear(); stack.assign(1, r);
+        while (!stack.empty()) {
+            int u = stack.back(); stack.pop_back();
+            sub.push_back(u);
+            if (A.depth[u] >= k) continue;
+            Id_Span nb = A.neighbors(u);
+            for (const int* q = nb.end(); q != nb.begin();) {  // reversed: pop in child order
+                int v = *--q;
+                if (A.parent_of[v] == u) stack.push_back(v);
+            }
         }
+        string shard = base + "_" + to_string(r) + ".dot";
+        size_t bytes = write_dot_file(A, shard, &sub, true, r, opt.buffer_bytes);
+        if (!bytes) continue;
+        total += bytes;
+        files.push_back(shard);
     }
-    ofs << "}\n";
-    cerr << "[graphviz] wrote " << filename << " (render with: dot -Tpng " << filename << " -o porphyry.png)\n";
+    ARBOR_COUNT(graphviz_bytes, total);
+    cerr << "[graphviz] wrote " << files.size() << " file(s), " << total << " bytes (first: " << filename << ")\n";
+    return files;
 }
 
 // Render a Graphviz DOT file into an image using the `dot` tool.
@@ -381,35 +4207,65 @@ bool render_graphviz(const string& dotfile, const string& outfile){
     return true;
 }
 
+// Runs render_graphviz on a background thread; `dot` can take minutes on big
+// graphs, so callers keep working and get() the result when they need it.
+std::future<bool> render_graphviz_async(const string& dotfile, const string& outfile){
+    return std::async(std::launch::async, render_graphviz, dotfile, outfile);
+}
 
 
+#ifndef ARBOR_NO_MAIN   // bench.cpp and tests.cpp include this file for the library code only
 int main(){
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
-    // Universe size: set comfortably larger than total nodes you plan to add.
+    // Universe size: initial VEB capacity; it doubles automatically when exceeded.
+    // The sample fits in 256 IDs, so use the compile-time VEB for it.
     Arbor arbor(/*U=*/256);
+    arbor.use_index<Static_Van_Emde_Boas<8>>("veb_static");
 
     // --- Measure build time for the sample animal taxonomy ---
     auto t_build0 = high_resolution_clock::now();
-    build_sample_students(arbor);
+    {
+        ARBOR_ALLOC_SCOPE(build_sample);
+        build_sample_students(arbor);
+    }
     auto t_build1 = high_resolution_clock::now();
     auto build_us = duration_cast<microseconds>(t_build1 - t_build0).count();
 
     cout << "Build time (sample animals): " << build_us << " us\n";
 
+    // --- Freeze: CSR adjacency + LCA index for O(log n) distance queries ---
+    auto t_i0 = high_resolution_clock::now();
+    bool indexed = arbor.freeze();
+    auto t_i1 = high_resolution_clock::now();
+    cout << "Freeze (CSR + LCA index" << (indexed ? "" : ", skipped: not a forest") << "): "
+         << duration_cast<microseconds>(t_i1 - t_i0).count() << " us\n";
+
+    // --- Renumber IDs in DFS preorder so each subtree is a contiguous ID range ---
+    auto t_r0 = high_resolution_clock::now();
+    bool renumbered = !arbor.renumber_preorder().empty();
+    auto t_r1 = high_resolution_clock::now();
+    cout << "Renumber (DFS preorder" << (renumbered ? "" : ", skipped: not a forest") << "): "
+         << duration_cast<microseconds>(t_r1 - t_r0).count() << " us\n";
+
     // --- VEB view ---
     arbor.dump_veb_view();
 
-    // --- ASCII tree diagram (rooted at "entity") ---
-    cout << "\nASCII Diagram (root=entity)\n";
-    print_ascii_tree_from_root(arbor, "entity");
+    // --- Memory footprint ---
+    cout << "\n";
+    arbor.memory_usage().print();
+
+    // --- ASCII tree diagram (rooted at "Ser_viviente", the sample's root) ---
+    cout << "\nASCII Diagram (root=Ser_viviente)\n";
+    print_ascii_tree_from_root(arbor, "Ser_viviente");
 
     // --- Graphviz DOT output ---
     emit_graphviz(arbor, "porphyry.dot");
     
-    // Attempt to render the DOT file to PNG (requires Graphviz `dot` in PATH).
-    render_graphviz("porphyry.dot", "porphyry.png");
+    // Attempt to render the DOT file to PNG (requires Graphviz `dot` in PATH),
+    // in the background while the path queries run.
+    auto rendered = render_graphviz_async("porphyry.dot", "porphyry.png");
 
     // --- Measure Dijkstra time for a sample query ---
     string node1 = "Ingenieria";
@@ -422,7 +4278,7 @@ int main(){
     if (path.empty()) {
         cout << "\nNo path found between " << node1 << " and " << node2 << endl;
     } else {
-        cout << "\nShortest path (" << node1 << " -> " << node2 << "):\n" << join_labels(path, arbor.label_of) << "\n";
+        cout << "\nShortest path (" << node1 << " -> " << node2 << "):\n" << join_labels(path, arbor) << "\n";
         int edges = (int)path.size() - 1;
         int nodes_between = max(0, (int)path.size() - 2);
         cout << "Edges (hops): " << edges << "\n";
@@ -430,5 +4286,17 @@ int main(){
         cout << "Dijkstra time: " << dijk_us << " us\n";
     }
 
+    auto t_l0 = high_resolution_clock::now();
+    int hops = arbor.distance(node1, node2);
+    auto t_l1 = high_resolution_clock::now();
+    cout << "LCA distance: " << hops << " hops in "
+         << duration_cast<nanoseconds>(t_l1 - t_l0).count() << " ns\n";
+
+    rendered.get();
+#ifdef ARBOR_STATS
+    dump_stats();
+#endif
+
     return 0;
-}
\ No newline at end of file
+}
+#endif // ARBOR_NO_MAIN
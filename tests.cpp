@@ -0,0 +1,1307 @@
+// Randomized checks of the ID indexes and of Arbor's graph structures against
+// simple references (std::set, plain BFS / Dijkstra).
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o arbor_tests tests.cpp && ./arbor_tests
+//
+// Under the sanitizers (the concurrent checks are meant for -fsanitize=thread):
+//   g++ -std=c++17 -O1 -g -pthread -fsanitize=address,undefined -o arbor_tests tests.cpp
+//   g++ -std=c++17 -O1 -g -pthread -fsanitize=thread -o arbor_tests tests.cpp
+//
+// Options:
+//   --filter TEXT    only run tests whose name contains TEXT
+//
+// Exits non-zero if any check fails.
+
+#define ARBOR_NO_MAIN
+#include "main.cpp"
+
+// ------------------------------ Harness --------------------------------------
+static int g_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { ++g_failures; cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond "\n"; } \
+} while (0)
+#define CHECK_EQ(a, b) do { \
+    auto a_ = (a); auto b_ = (b); \
+    if (!(a_ == b_)) { \
+        ++g_failures; \
+        cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ failed: " #a " == " #b " (" << a_ << " vs " << b_ << ")\n"; \
+    } \
+} while (0)
+
+// A random forest of n nodes: node i > 0 gets a parent among the earlier
+// nodes with probability 1 - 1/roots_every, so IDs follow insertion order.
+static Arbor random_forest(int n, int roots_every, uint32_t seed, Index_Kind kind = Index_Kind::VEB,
+                           pmr::memory_resource* mem = nullptr) {
+    Arbor A(16, true, kind, mem);
+    mt19937 rng(seed);
+    A.ensure_node("n0");
+    for (int i = 1; i < n; ++i) {
+        int c = A.ensure_node("n" + to_string(i));
+        if (rng() % roots_every) A.connect_ids((int)(rng() % i), c);
+    }
+    return A;
+}
+
+// Adds extra random undirected edges, so the graph is no longer a forest.
+static void add_random_edges(Arbor& A, int edges, uint32_t seed, uint32_t max_weight = 1) {
+    mt19937 rng(seed);
+    for (int i = 0; i < edges; ++i) {
+        int a = (int)(rng() % A.size()), b = (int)(rng() % A.size());
+        A.connect_ids(a, b, max_weight > 1 ? 1 + rng() % max_weight : 1);
+    }
+}
+
+// Reference hop distances from s over adj (not the CSR).
+static vector<int> bfs_reference(const Arbor& A, int s) {
+    vector<int> d(A.size(), -1);
+    deque<int> q{s};
+    d[s] = 0;
+    while (!q.empty()) {
+        int u = q.front(); q.pop_front();
+        for (int v : A.adj[u]) if (d[v] == -1) { d[v] = d[u] + 1; q.push_back(v); }
+    }
+    return d;
+}
+
+// Reference weighted distances from s over adj / adj_weight.
+static vector<long long> dijkstra_reference(const Arbor& A, int s) {
+    vector<long long> d(A.size(), -1);
+    using P = pair<long long,int>;
+    priority_queue<P, vector<P>, greater<P>> pq;
+    pq.push({0, s});
+    while (!pq.empty()) {
+        auto [du, u] = pq.top(); pq.pop();
+        if (d[u] != -1) continue;
+        d[u] = du;
+        for (size_t j = 0; j < A.adj[u].size(); ++j) {
+            long long w = A.weighted ? A.adj_weight[u][j] : 1;
+            if (d[A.adj[u][j]] == -1) pq.push({du + w, A.adj[u][j]});
+        }
+    }
+    return d;
+}
+
+// path is a walk s -> t along existing edges.
+static bool is_walk(const Arbor& A, const vector<int>& path, int s, int t) {
+    if (path.empty() || path.front() != s || path.back() != t) return false;
+    for (size_t i = 1; i < path.size(); ++i) {
+        const auto& a = A.adj[path[i - 1]];
+        if (find(a.begin(), a.end(), path[i]) == a.end()) return false;
+    }
+    return true;
+}
+
+static string id_label(int id) { return "n" + to_string(id); }
+
+static string read_file(const string& path) {
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// ------------------------------- ID indexes ----------------------------------
+// Random inserts / erases / queries on every backend against std::set.
+static void test_index_ordered_set() {
+    const int universes[] = {1, 2, 3, 5, 16, 17, 64, 100, 257, 4096};
+    for (auto& kv : INDEX_KINDS) {
+        for (int U : universes) {
+            for (bool lazy : {false, true}) {
+                auto idx = make_id_index(kv.second, U, lazy);
+                set<int> ref;
+                mt19937 rng(U * 31 + lazy);
+                for (int op = 0; op < 4 * U + 64; ++op) {
+                    int x = (int)(rng() % U);
+                    switch (rng() % 4) {
+                        case 0: case 1:
+                            idx->insert(x); ref.insert(x);
+                            break;
+                        case 2:
+                            CHECK_EQ(idx->erase(x), ref.erase(x) == 1);
+                            break;
+                        default: {
+                            auto it = ref.upper_bound(x);
+                            CHECK_EQ(idx->successor(x), it == ref.end() ? -1 : *it);
+                            auto lo = ref.lower_bound(x);
+                            CHECK_EQ(idx->predecessor(x), lo == ref.begin() ? -1 : *prev(lo));
+                        }
+                    }
+                    CHECK_EQ(idx->contains(x), ref.count(x) == 1);
+                    CHECK_EQ(idx->min(), ref.empty() ? -1 : *ref.begin());
+                    CHECK_EQ(idx->max(), ref.empty() ? -1 : *ref.rbegin());
+                }
+                CHECK_EQ(idx->successor(-1), ref.empty() ? -1 : *ref.begin());
+                vector<int> keys;
+                idx->enumerate(keys);
+                CHECK(keys == vector<int>(ref.begin(), ref.end()));
+                int lo = (int)(rng() % U), hi = lo + (int)(rng() % (U - lo + 1));
+                vector<int> in_range;
+                idx->for_each_in_range(lo, hi, [&](int k) { in_range.push_back(k); });
+                CHECK(in_range == vector<int>(ref.lower_bound(lo), ref.lower_bound(hi)));
+                auto copy = idx->clone();
+                for (int k : ref) CHECK(copy->contains(k));
+            }
+        }
+    }
+}
+
+// insert_sorted into an empty index against std::set.
+static void test_index_bulk() {
+    mt19937 rng(5);
+    for (auto& kv : INDEX_KINDS) {
+        for (int U : {7, 64, 1000, 1 << 14}) {
+            set<int> ref;
+            for (int i = 0; i < U / 3; ++i) ref.insert((int)(rng() % U));
+            vector<int> keys(ref.begin(), ref.end());
+            auto idx = make_id_index(kv.second, U, true);
+            idx->insert_sorted(keys.data(), keys.size());
+            vector<int> got;
+            idx->enumerate(got);
+            CHECK(got == keys);
+            for (int x = 0; x < U; x += 1 + U / 97) {
+                auto it = ref.upper_bound(x);
+                CHECK_EQ(idx->successor(x), it == ref.end() ? -1 : *it);
+            }
+        }
+    }
+}
+
+// for_each_in_range with bounds outside the universe (past it, negative) and
+// parallel_for_each_in_range against the sequential scan, on every backend.
+static void test_index_ranges() {
+    const int U = 1 << 14;
+    for (auto& kv : INDEX_KINDS) {
+        for (bool lazy : {false, true}) {
+            auto idx = make_id_index(kv.second, U, lazy);
+            set<int> ref;
+            mt19937 rng(7);
+            for (int i = 0; i < 3000; ++i) { int x = (int)(rng() % U); idx->insert(x); ref.insert(x); }
+            auto scan = [&](int lo, int hi) {
+                vector<int> got;
+                idx->for_each_in_range(lo, hi, [&](int k) { got.push_back(k); });
+                return got;
+            };
+            auto want = [&](int lo, int hi) {
+                lo = max(lo, 0);
+                return hi <= lo ? vector<int>() : vector<int>(ref.lower_bound(lo), ref.lower_bound(hi));
+            };
+            const pair<int,int> ranges[] = {{U + 100, 3 * U}, {U, U + 1}, {U - 70, 3 * U}, {-100, 50},
+                                            {-5, -1}, {-100, 3 * U}, {INT_MIN, INT_MAX}, {500, 100}};
+            for (auto [lo, hi] : ranges) {
+                CHECK(scan(lo, hi) == want(lo, hi));
+                for (int threads : {1, 3, 8}) {
+                    vector<vector<int>> per(threads);
+                    idx->parallel_for_each_in_range(lo, hi, threads, [&](int k, int tid) { per[tid].push_back(k); });
+                    // Per-tid runs, concatenated in tid order, are the keys in order.
+                    vector<int> all;
+                    for (auto& v : per) all.insert(all.end(), v.begin(), v.end());
+                    CHECK(all == want(lo, hi));
+                }
+            }
+        }
+    }
+}
+
+// The VEB trees' key iterators and range(lo, hi) against std::set.
+template <class Tree>
+static void check_key_iterators(const Tree& tree, const set<int>& ref, int U, mt19937& rng) {
+    vector<int> iterated;
+    for (int k : tree) iterated.push_back(k);
+    CHECK(iterated == vector<int>(ref.begin(), ref.end()));
+    for (int q = 0; q < 16; ++q) {
+        int lo = (int)(rng() % U), hi = lo + (int)(rng() % (U - lo + 1));
+        vector<int> in_range;
+        for (int k : tree.range(lo, hi)) in_range.push_back(k);
+        CHECK(in_range == vector<int>(ref.lower_bound(lo), ref.lower_bound(hi)));
+    }
+}
+
+static void test_veb_iterators() {
+    for (int U : {1, 17, 100, 4096}) {
+        for (bool lazy : {false, true}) {
+            Van_Emde_Boas sq(U, lazy);
+            Van_Emde_Boas_Pow2 p2(U, lazy);
+            Flat_Van_Emde_Boas flat(U);
+            set<int> ref;
+            mt19937 rng(U + lazy);
+            // Insert-heavy rounds, then erase-heavy ones (down to an empty set and
+            // back), so the scans also walk trees whose clusters were emptied.
+            for (int round = 0; round < 6; ++round) {
+                for (int i = 0; i < U / 3 + 1; ++i) {
+                    int x = (int)(rng() % U);
+                    if (rng() % 4 < (round < 3 ? 3u : 1u)) {
+                        sq.insert(x); p2.insert(x); flat.insert(x); ref.insert(x);
+                    } else {
+                        bool had = ref.erase(x) == 1;
+                        CHECK_EQ(sq.erase(x), had);
+                        CHECK_EQ(p2.erase(x), had);
+                        CHECK_EQ(flat.erase(x), had);
+                    }
+                }
+                if (round == 4) {
+                    for (int x : vector<int>(ref.begin(), ref.end())) { sq.erase(x); p2.erase(x); flat.erase(x); }
+                    ref.clear();
+                }
+                check_key_iterators(sq, ref, U, rng);
+                check_key_iterators(p2, ref, U, rng);
+                check_key_iterators(flat, ref, U, rng);
+            }
+        }
+    }
+}
+
+// The compile-time VEB against std::set.
+static void test_static_veb() {
+    mt19937 rng(6);
+    Veb_Index<Static_Van_Emde_Boas<10>> s("static");
+    set<int> ref;
+    for (int op = 0; op < 5000; ++op) {
+        int x = (int)(rng() % 1024);
+        if (rng() % 3) { s.insert(x); ref.insert(x); }
+        else CHECK_EQ(s.erase(x), ref.erase(x) == 1);
+        auto it = ref.upper_bound(x);
+        CHECK_EQ(s.successor(x), it == ref.end() ? -1 : *it);
+        auto lo = ref.lower_bound(x);
+        CHECK_EQ(s.predecessor(x), lo == ref.begin() ? -1 : *prev(lo));
+    }
+    static_assert([] {
+        Static_Van_Emde_Boas<8> t;
+        t.insert(3); t.insert(200);
+        return t.successor(3) == 200 && t.predecessor(200) == 3 && t.min() == 3;
+    }(), "constexpr use");
+}
+
+// use_index<Static_Van_Emde_Boas<N>>: IDs past 2^N move the Arbor back to a
+// runtime index of its index_kind, keeping every ID.
+static void test_static_fallback() {
+    for (auto& kv : INDEX_KINDS) {
+        Arbor A(16, true, kv.second);
+        for (int i = 0; i < 40; ++i) A.ensure_node(id_label(i));
+        CHECK(A.use_index<Static_Van_Emde_Boas<6>>("veb_static"));
+        CHECK_EQ(string(A.veb->name()), string("veb_static"));
+        CHECK_EQ(A.U, 64);
+        for (int i = 40; i < 200; ++i) A.connect_parent_child(id_label(i / 2), id_label(i));
+        CHECK_EQ(string(A.veb->name()), string(kv.first));
+        CHECK(A.U >= 200);
+        for (int v = 0; v < A.size(); ++v) CHECK(A.veb->contains(v));
+        CHECK_EQ(A.veb->max(), 199);
+        CHECK(!A.use_index<Static_Van_Emde_Boas<6>>("veb_static"));
+        CHECK_EQ(string(A.veb->name()), string(kv.first));
+    }
+}
+
+// ------------------------------ Label interning ------------------------------
+// Label_Interner across several rehashes (ending near the 0.75 load factor, so
+// many labels share a home slot), unknown labels, and a hand-built table where
+// two labels share one full hash.
+static void test_label_interner() {
+    Label_Interner L;
+    vector<string> want;
+    for (int i = 0; i < 3000; ++i) {
+        string s = "label" + to_string(i);
+        auto r = L.intern(s);
+        CHECK(r.second);
+        CHECK_EQ(r.first, i);
+        want.push_back(s);
+    }
+    CHECK(L.slots.size() >= 4096);
+    for (int i = 0; i < 3000; ++i) {
+        CHECK_EQ(L.find(want[i]), i);
+        CHECK_EQ(string(L.view(i)), want[i]);
+        CHECK(!L.intern(want[i]).second);
+    }
+    CHECK_EQ(L.find("label3000"), -1);
+    CHECK_EQ(L.find(""), -1);
+    CHECK_EQ(L.find("label1 "), -1);
+    CHECK_EQ(L.size(), 3000);
+
+    // Equal cached hashes: probe() must still compare the bytes.
+    const char bytes[] = "abcabd";
+    const uint64_t offs[] = {0, 3, 6};
+    Label_Interner::Slot table[4] = {{0, 4}, {1, 4}, {-1, 0}, {-1, 0}};
+    CHECK_EQ(Label_Interner::probe(table, 4, bytes, offs, "abc", 4), 0);
+    CHECK_EQ(Label_Interner::probe(table, 4, bytes, offs, "abd", 4), 1);
+    CHECK_EQ(Label_Interner::probe(table, 4, bytes, offs, "abe", 4), -1);
+    CHECK_EQ(Label_Interner::probe(table, 4, bytes, offs, "abc", 8), -1);
+
+    // connect_parent_child with label_of() views (whole labels and pieces of
+    // them) while every new parent may reallocate the arena.
+    Arbor A;
+    A.ensure_node("root-of-everything");
+    for (int i = 0; i < 200; ++i) {
+        int k = i % A.size();
+        A.connect_parent_child("p" + to_string(i), A.label_of(k));
+        string_view lab = A.label_of(k);
+        A.connect_parent_child("q" + to_string(i), lab.substr(lab.size() / 2));
+    }
+    CHECK(A.id_of("verything") != -1);
+    CHECK(A.id_of("0") != -1);
+    for (int v = 0; v < A.size(); ++v) CHECK_EQ(A.id_of(A.label_of(v)), v);
+}
+
+// ------------------------------- CSR snapshot --------------------------------
+// freeze(): every node's run is [parent][children...][rest], holding exactly
+// adj[u] (the same weights included) as a multiset.
+static void check_csr(const Arbor& A) {
+    for (int u = 0; u < A.size(); ++u) {
+        Id_Span nb = A.neighbors(u);
+        const uint32_t* w = A.neighbor_weights(u);
+        vector<pair<int,uint32_t>> got, want;
+        for (size_t j = 0; j < nb.size(); ++j) got.push_back({nb.first[j], w ? w[j] : 1});
+        for (size_t j = 0; j < A.adj[u].size(); ++j) want.push_back({A.adj[u][j], A.weighted ? A.adj_weight[u][j] : 1});
+        sort(got.begin(), got.end());
+        sort(want.begin(), want.end());
+        CHECK(got == want);
+        if (A.parent_of[u] != -1 && !nb.empty()) CHECK_EQ(nb.first[0], A.parent_of[u]);
+        set<int> kids;
+        for (int v : A.children(u)) {
+            CHECK_EQ(A.parent_of[v], u);
+            CHECK(v != A.parent_of[u]);
+            CHECK(kids.insert(v).second);
+        }
+        for (int v : A.adj[u]) if (A.parent_of[v] == u && v != A.parent_of[u]) CHECK(kids.count(v));
+    }
+}
+
+static void test_freeze_csr() {
+    for (uint32_t seed = 1; seed <= 20; ++seed) {
+        Arbor A = random_forest(200, 8, seed);
+        if (seed % 2) add_random_edges(A, 40, seed, seed % 4 ? 1 : 9);
+        A.connect_ids(3, 3);                       // self-link
+        A.connect_ids(A.parent_of[5] == -1 ? 0 : A.parent_of[5], 5);   // duplicate edge
+        A.freeze();
+        check_csr(A);
+    }
+    // A parent 2-cycle (a -> b, then b -> a): b goes in a's run once as its
+    // parent and once among the rest, each with its own edge's weight.
+    Arbor cyc;
+    cyc.connect_parent_child("a", "b", 3);
+    cyc.connect_parent_child("b", "a", 7);
+    cyc.freeze();
+    check_csr(cyc);
+    CHECK(cyc.children(cyc.id_of("a")).empty());
+    // New (isolated) nodes keep a frozen CSR usable.
+    Arbor A = random_forest(50, 5, 3);
+    A.freeze();
+    int z = A.ensure_node("z");
+    CHECK(A.frozen);
+    CHECK(A.neighbors(z).empty() && A.children(z).empty());
+    CHECK_EQ(A.csr.offsets.size(), (size_t)A.size() + 1);
+    CHECK(A.freeze());
+    check_csr(A);
+}
+
+// ------------------------------- Tree index ----------------------------------
+static void check_tree_distances(const Arbor& A, int sources, uint32_t seed) {
+    mt19937 rng(seed);
+    for (int q = 0; q < sources; ++q) {
+        int s = (int)(rng() % A.size());
+        vector<int> d = bfs_reference(A, s);
+        for (int t = 0; t < A.size(); ++t) {
+            CHECK_EQ(A.tree_distance(s, t), d[t]);
+            vector<int> path;
+            if (d[t] != -1 && A.tree_path(s, t, path)) CHECK(is_walk(A, path, s, t) && (int)path.size() == d[t] + 1);
+        }
+    }
+}
+
+static void test_tree_index() {
+    for (uint32_t seed = 1; seed <= 10; ++seed) {
+        Arbor A = random_forest(300, 10, seed);
+        CHECK(A.freeze());
+        CHECK(A.tree_ready);
+        check_tree_distances(A, 8, seed);
+    }
+    Arbor cyclic = random_forest(50, 10, 3);
+    add_random_edges(cyclic, 5, 3);
+    CHECK(!cyclic.freeze());
+}
+
+// Leaves attached after freeze() keep the tree index current (including a
+// path deeper than the ancestor table covers, which forces a rebuild).
+static void test_incremental_lca() {
+    for (uint32_t seed = 1; seed <= 6; ++seed) {
+        Arbor A = random_forest(100, 6, seed);
+        A.freeze();
+        mt19937 rng(seed);
+        int chain = A.ensure_node("chain0");
+        for (int i = 0; i < 400; ++i) {
+            int c = A.ensure_node("leaf" + to_string(i));
+            int p = (i % 4 == 0) ? chain : (int)(rng() % (A.size() - 1));
+            A.connect_ids(p, c);
+            if (i % 4 == 0) chain = c;
+            CHECK(A.tree_ready);
+        }
+        check_tree_distances(A, 6, seed);
+        Arbor rebuilt = A;
+        CHECK(rebuilt.build_tree_index());
+        for (int v = 0; v < A.size(); ++v) CHECK_EQ(A.depth[v], rebuilt.depth[v]);
+    }
+}
+
+// Leaf insertions after build_intervals() keep tin/tout as long as the ID
+// space, and refresh_intervals() recomputes them without a freeze() or a tree
+// index rebuild; a new isolated root keeps them valid outright.
+static void test_incremental_intervals() {
+    for (uint32_t seed = 1; seed <= 4; ++seed) {
+        Arbor A = random_forest(200, 9, seed);
+        CHECK(A.build_intervals());
+        int root = A.ensure_node("late-root");
+        CHECK(A.intervals_ready);
+        CHECK_EQ(A.tin[root], root);
+        CHECK_EQ(A.tout[root], root + 1);
+        mt19937 rng(seed);
+        for (int i = 0; i < 150; ++i) {
+            int c = A.ensure_node("leaf" + to_string(i));
+            A.connect_ids((int)(rng() % (A.size() - 1)), c);
+            CHECK(!A.intervals_ready);
+            CHECK_EQ(A.tin.size(), (size_t)A.size());
+            CHECK_EQ(A.tout.size(), (size_t)A.size());
+        }
+        CHECK(!A.frozen && A.tree_ready);
+        const int* up = A.up.data();
+        CHECK(A.refresh_intervals());
+        CHECK(A.intervals_ready && !A.frozen && A.up.data() == up);
+        Arbor rebuilt = A;
+        CHECK(rebuilt.build_intervals());
+        CHECK(A.tin == rebuilt.tin && A.tout == rebuilt.tout);
+        for (int u = 0; u < A.size(); u += 7)
+            for (int v = 0; v < A.size(); v += 5) {
+                bool anc = false;
+                for (int w = u; w != -1 && !anc; w = A.parent_of[w]) anc = (w == v);
+                CHECK_EQ(A.is_descendant(u, v), anc);
+            }
+    }
+}
+
+// renumber_preorder() on weighted forests whose parents come in random ID
+// order: the returned old -> new map carries every label, parent, adjacency
+// list and weight, IDs become preorder ranks, and descendants(v) (available
+// only while preorder_ids holds) matches a parent walk.
+static void test_renumber_preorder() {
+    for (uint32_t seed = 1; seed <= 4; ++seed) {
+        mt19937 rng(seed);
+        int n = 300;
+        Arbor A;
+        vector<int> order(n);
+        for (int i = 0; i < n; ++i) { A.ensure_node(id_label(i)); order[i] = i; }
+        shuffle(order.begin(), order.end(), rng);
+        for (int j = 1; j < n; ++j)
+            if (rng() % 11) A.connect_ids(order[rng() % j], order[j], 1 + rng() % 9);
+        CHECK(!A.preorder_ids);
+        CHECK(A.build_intervals());
+        CHECK(!A.preorder_ids);
+        Arbor old = A;
+        vector<int> m = A.renumber_preorder();
+        CHECK_EQ(m.size(), (size_t)n);
+        CHECK(A.preorder_ids && A.intervals_ready && A.tree_ready && A.weighted);
+        vector<int> seen(n, 0);
+        for (int v = 0; v < n; ++v) {
+            int u = m[v];
+            CHECK(u >= 0 && u < n && !seen[u]++);
+            CHECK_EQ(u, old.tin[v]);
+            CHECK_EQ(A.tin[u], u);
+            CHECK_EQ(A.label_of(u), old.label_of(v));
+            CHECK_EQ(A.id_of(old.label_of(v)), u);
+            CHECK_EQ(A.parent_of[u], old.parent_of[v] == -1 ? -1 : m[old.parent_of[v]]);
+            CHECK_EQ(A.adj[u].size(), old.adj[v].size());
+            for (size_t j = 0; j < min(A.adj[u].size(), old.adj[v].size()); ++j) {
+                CHECK_EQ(A.adj[u][j], m[old.adj[v][j]]);
+                CHECK_EQ(A.adj_weight[u][j], old.adj_weight[v][j]);
+            }
+        }
+        for (int v = 0; v < n; ++v) {
+            vector<int> got, want;
+            for (int k : A.descendants(v)) got.push_back(k);
+            for (int u = 0; u < n; ++u) {
+                int w = u;
+                while (w != -1 && w != v) w = A.parent_of[w];
+                if (w == v) want.push_back(u);
+            }
+            CHECK(got == want);
+            CHECK_EQ(A.tout[v] - v, (int)want.size());
+        }
+        // A new edge drops preorder_ids until the next renumbering.
+        A.connect_ids(0, A.ensure_node("late-leaf"));
+        CHECK(!A.preorder_ids && !A.intervals_ready);
+        CHECK(A.refresh_intervals());
+        CHECK(!A.preorder_ids);
+        CHECK(!A.renumber_preorder().empty());
+        CHECK(A.preorder_ids);
+        CHECK_EQ(A.parent_of[A.id_of("late-leaf")], 0);
+    }
+    Arbor cyclic = random_forest(50, 5, 3);
+    add_random_edges(cyclic, 5, 3);
+    CHECK(cyclic.renumber_preorder().empty());
+    CHECK(!cyclic.preorder_ids);
+}
+
+// ------------------------------- Path engines --------------------------------
+// Bidirectional BFS (shortest_path / distance / batch queries without a tree
+// index) against a one-sided BFS, frozen and not.
+static void test_bidirectional_bfs() {
+    for (uint32_t seed = 1; seed <= 8; ++seed) {
+        Arbor A = random_forest(250, 7, seed);
+        add_random_edges(A, 60, seed, seed % 3 ? 1 : 20);   // weights must not change hop answers
+        if (seed % 2) A.freeze();
+        CHECK(!A.tree_ready);
+        mt19937 rng(seed);
+        vector<pair<int,int>> pairs;
+        for (int q = 0; q < 6; ++q) {
+            int s = (int)(rng() % A.size());
+            vector<int> d = bfs_reference(A, s);
+            vector<int> row(A.size());
+            A.distances_from(s, row.data());
+            CHECK(row == d);
+            for (int t = 0; t < A.size(); t += 3) {
+                pairs.push_back({s, t});
+                CHECK_EQ(A.distance(id_label(s), id_label(t)), d[t]);
+                vector<int> path = A.shortest_path(id_label(s), id_label(t));
+                if (d[t] == -1) CHECK(path.empty());
+                else CHECK(is_walk(A, path, s, t) && (int)path.size() == d[t] + 1);
+                CHECK_EQ(A.shortest_path_dijkstra(s, t).size(), path.size());
+            }
+        }
+        vector<int> out(pairs.size());
+        A.batch_distances(pairs.data(), pairs.size(), out.data(), 3);
+        Arbor::Path_Batch pb = A.batch_paths(pairs.data(), pairs.size(), 3);
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            int s = pairs[i].first, t = pairs[i].second;
+            int d = bfs_reference(A, s)[t];
+            CHECK_EQ(out[i], d);
+            vector<int> path(pb.nodes.begin() + pb.offsets[i], pb.nodes.begin() + pb.offsets[i + 1]);
+            if (d == -1) CHECK(path.empty());
+            else CHECK(is_walk(A, path, s, t) && (int)path.size() == d + 1);
+        }
+    }
+}
+
+// weighted_distance / weighted_shortest_path (one- and two-sided) against a
+// plain binary-heap Dijkstra.
+static void test_weighted_dijkstra() {
+    // s-a-t is cheaper in hops, s-b-c-t in weight; hop queries take the former.
+    Arbor W;
+    W.connect_parent_child("s", "a", 10);
+    W.connect_parent_child("a", "t", 10);
+    W.connect_parent_child("s", "b", 1);
+    W.connect_parent_child("b", "c", 1);
+    W.connect_parent_child("c", "t", 1);
+    CHECK_EQ(W.distance("s", "t"), 2);
+    CHECK_EQ(W.shortest_path("s", "t").size(), (size_t)3);
+    CHECK_EQ(W.weighted_distance("s", "t"), 3);
+    CHECK_EQ(W.weighted_shortest_path("s", "t").size(), (size_t)4);
+    vector<pair<string,string>> st = {{"s", "t"}};
+    CHECK_EQ(W.batch_distances(st)[0], 2);
+    for (uint32_t seed = 1; seed <= 8; ++seed) {
+        Arbor A = random_forest(200, 9, seed);
+        add_random_edges(A, 80, seed, 50);
+        if (seed % 2) A.freeze();
+        mt19937 rng(seed);
+        for (int q = 0; q < 5; ++q) {
+            int s = (int)(rng() % A.size());
+            vector<long long> d = dijkstra_reference(A, s);
+            for (int t = 0; t < A.size(); t += 2) {
+                for (bool bidi : {false, true}) {
+                    CHECK_EQ(A.weighted_distance(id_label(s), id_label(t), bidi), d[t]);
+                    vector<int> path = A.weighted_shortest_path(id_label(s), id_label(t), bidi);
+                    if (d[t] == -1) { CHECK(path.empty()); continue; }
+                    CHECK(is_walk(A, path, s, t));
+                    long long cost = 0;
+                    for (size_t i = 1; i < path.size(); ++i) {
+                        const auto& a = A.adj[path[i - 1]];
+                        uint32_t best = UINT32_MAX;
+                        for (size_t j = 0; j < a.size(); ++j) if (a[j] == path[i]) best = min(best, A.adj_weight[path[i - 1]][j]);
+                        cost += best;
+                    }
+                    CHECK_EQ(cost, d[t]);
+                }
+            }
+        }
+    }
+}
+
+// ------------------------------- Path cache ----------------------------------
+// Cached answers match a plain BFS, including after edges invalidate them.
+static void test_path_cache() {
+    for (uint32_t seed = 1; seed <= 4; ++seed) {
+        Arbor A = random_forest(150, 6, seed);
+        if (seed % 2) A.freeze();
+        A.enable_path_cache(seed == 4 ? 4096 : 1 << 20);   // seed 4: constant eviction
+        mt19937 rng(seed);
+        for (int round = 0; round < 4; ++round) {
+            for (int q = 0; q < 300; ++q) {
+                int a = (int)(rng() % A.size()), b = (int)(rng() % A.size());
+                string s = id_label(a), t = id_label(b);
+                int d = A.distance(s, t);
+                CHECK_EQ(d, bfs_reference(A, a)[b]);
+                vector<int> path = A.shortest_path(s, t);
+                CHECK_EQ((int)path.size() - 1, d);
+                if (d != -1) CHECK(is_walk(A, path, A.id_of(s), A.id_of(t)));
+            }
+            add_random_edges(A, 3, seed * 7 + round);
+        }
+        CHECK(A.path_cache->hits() > 0);
+    }
+    // Single and batch queries share the cache, so they must agree whichever
+    // runs first (also on a weighted graph, where hops and weights disagree).
+    for (bool batch_first : {false, true}) {
+        Arbor G = random_forest(120, 6, 8);
+        add_random_edges(G, 40, 8, 30);
+        G.enable_path_cache(1 << 20);
+        vector<pair<int,int>> pairs;
+        for (int t = 0; t < G.size(); ++t) pairs.push_back({5, t});
+        vector<int> d = bfs_reference(G, 5), single(pairs.size()), batch(pairs.size());
+        auto run_single = [&] { for (size_t i = 0; i < pairs.size(); ++i) single[i] = G.distance("n5", id_label(pairs[i].second)); };
+        if (!batch_first) run_single();
+        G.batch_distances(pairs.data(), pairs.size(), batch.data(), 2);
+        if (batch_first) run_single();
+        CHECK(single == d);
+        CHECK(batch == d);
+        Arbor::Path_Batch pb = G.batch_paths(pairs.data(), pairs.size(), 2);
+        for (size_t i = 0; i < pairs.size(); ++i) CHECK_EQ((long long)(pb.offsets[i + 1] - pb.offsets[i]) - 1, (long long)d[i]);
+    }
+    // A cached "unreachable" for a node that then becomes a leaf.
+    Arbor A;
+    A.ensure_node("r");
+    A.freeze();
+    A.enable_path_cache(1 << 16);
+    A.ensure_node("x");
+    CHECK_EQ(A.distance("x", "r"), -1);
+    A.connect_parent_child("r", "x");
+    CHECK(A.tree_ready);
+    CHECK_EQ(A.distance("x", "r"), 1);
+    CHECK_EQ(A.shortest_path("r", "x").size(), (size_t)2);
+}
+
+// Path_Cache::erase_node against a map of what was stored: it drops exactly
+// the pairs with v as an endpoint (self-pairs included), also while the CLOCK
+// hand evicts and slots are reused.
+static void test_path_cache_erase() {
+    for (size_t budget : {size_t(1) << 22, size_t(1) << 13}) {
+        Path_Cache cache(budget, 4);
+        map<pair<int,int>, int> stored;
+        mt19937 rng(12);
+        for (int op = 0; op < 20000; ++op) {
+            int s = (int)(rng() % 40), t = (int)(rng() % 40);
+            if (rng() % 8) {
+                int path[2] = {s, t};
+                cache.put(s, t, s == t ? 0 : 1 + (int)(rng() % 9), rng() % 2 ? path : nullptr, s == t ? 1 : 2);
+                int d;
+                if (cache.get(s, t, d, nullptr)) stored[minmax(s, t)] = d;
+            } else {
+                cache.erase_node(s);
+                for (auto it = stored.begin(); it != stored.end();)
+                    it = (it->first.first == s || it->first.second == s) ? stored.erase(it) : next(it);
+                for (int u = 0; u < 40; ++u) { int d; CHECK(!cache.get(s, u, d, nullptr)); }
+            }
+        }
+        size_t live = 0;
+        for (auto& [st, want] : stored) {
+            int d;
+            if (!cache.get(st.second, st.first, d, nullptr)) continue;   // evicted
+            ++live;
+            CHECK_EQ(d, want);
+        }
+        CHECK_EQ(cache.entries(), live);
+        if (budget > (1 << 20)) CHECK_EQ(live, stored.size());
+    }
+}
+
+// --------------------------- Concurrent snapshots ----------------------------
+// Readers pin versions while a writer publishes: a pinned version never
+// changes under the reader, and versions are reclaimed once unpinned.
+static void test_concurrent_arbor() {
+    Arbor base = random_forest(64, 100, 1);
+    Concurrent_Arbor C(std::move(base), 8);
+    atomic<bool> done{false};
+    atomic<int> bad{0};
+    vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&] {
+            int slot = C.register_reader();
+            if (slot < 0) { bad.fetch_add(1); return; }
+            while (!done.load()) {
+                auto snap = C.pin(slot);
+                int n = snap->size();
+                int last = n - 1;
+                if (!snap->frozen || !snap->tree_ready) bad.fetch_add(1);
+                if (snap->tree_distance(0, last) != bfs_reference(*snap, 0)[last]) bad.fetch_add(1);
+                if (snap->size() != n) bad.fetch_add(1);
+            }
+            C.unregister_reader(slot);
+        });
+    }
+    for (int i = 0; i < 200; ++i) {
+        C.stage_edge(id_label(i % 64), "w" + to_string(i));
+        C.publish();
+    }
+    done.store(true);
+    for (auto& th : readers) th.join();
+    CHECK_EQ(bad.load(), 0);
+    CHECK_EQ(C.reclaim_retired(), (size_t)0);
+    int slot = C.register_reader();
+    CHECK_EQ(C.pin(slot)->size(), 264);
+}
+
+// ---------------------------- Batch range matcher ----------------------------
+// match_ranges (AVX2 / NEON when enabled) against a scalar test, with lengths
+// that leave vector tails and empty / inverted ranges; then descendants_mask
+// against is_descendant.
+static void test_match_ranges() {
+    mt19937 rng(11);
+    for (size_t n : {0, 1, 7, 8, 9, 63, 64, 65, 200}) {
+        for (size_t nr : {0, 1, 3, 9}) {
+            vector<int> keys(n);
+            for (int& k : keys) k = (int)(rng() % 1000) - 20;
+            keys.push_back(INT_MIN);
+            keys.push_back(INT_MAX);
+            vector<Key_Range> ranges(nr);
+            for (auto& r : ranges) { r.lo = (int)(rng() % 1000) - 20; r.hi = r.lo + (int)(rng() % 200) - 40; }
+            vector<uint64_t> mask((keys.size() + 63) / 64, ~0ULL);
+            match_ranges(keys.data(), keys.size(), ranges.data(), nr, mask.data());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                bool want = false;
+                for (auto& r : ranges) want |= (keys[i] >= r.lo && keys[i] < r.hi);
+                CHECK_EQ((bool)((mask[i / 64] >> (i % 64)) & 1), want);
+            }
+        }
+    }
+    for (bool renumber : {false, true}) {
+        Arbor A = random_forest(500, 20, 4);
+        if (renumber) CHECK(!A.renumber_preorder().empty());
+        else CHECK(A.build_intervals());
+        vector<int> ids(A.size());
+        iota(ids.begin(), ids.end(), 0);
+        shuffle(ids.begin(), ids.end(), rng);
+        int genera[] = {0, 17, 250};
+        vector<int> out;
+        A.filter_descendants(ids.data(), ids.size(), genera, 3, out);
+        vector<int> want;
+        for (int v : ids) if (A.is_descendant(v, 0) || A.is_descendant(v, 17) || A.is_descendant(v, 250)) want.push_back(v);
+        CHECK(out == want);
+        for (int v : ids) {
+            bool anc = false;
+            for (int u = v; u != -1; u = A.parent_of[u]) anc |= (u == 17);
+            CHECK_EQ(A.is_descendant(v, 17), anc);
+        }
+    }
+}
+
+// ----------------------------- Snapshot files --------------------------------
+static void test_snapshot_roundtrip() {
+    string file = "tests_tmp.snp";
+    for (bool forest : {true, false}) {
+        Arbor A = random_forest(300, 12, 2);
+        if (!forest) add_random_edges(A, 20, 2);
+        CHECK(save_snapshot(A, file));
+        Mapped_Arbor M;
+        CHECK(M.open(file));
+        CHECK_EQ(M.size(), A.size());
+        mt19937 rng(2);
+        for (int q = 0; q < 200; ++q) {
+            string s = id_label((int)(rng() % A.size())), t = id_label((int)(rng() % A.size()));
+            CHECK_EQ(M.distance(s, t), A.distance(s, t));
+        }
+        for (int v = 0; v < A.size(); ++v) CHECK_EQ(M.id_of(M.label_of(v)), v);
+        CHECK_EQ(M.id_of("missing"), -1);
+    }
+    remove(file.c_str());
+}
+
+// Truncated or inconsistent snapshots are rejected by open() (under ASan any
+// out-of-bounds read during open would show up here too).
+static void test_snapshot_corrupt() {
+    string file = "tests_tmp.snp", bad = "tests_bad.snp";
+    Arbor A = random_forest(200, 12, 5);
+    CHECK(save_snapshot(A, file));
+    string image;
+    {
+        ifstream in(file, ios::binary);
+        image.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    auto open_with = [&](const string& bytes) {
+        { ofstream out(bad, ios::binary | ios::trunc); out.write(bytes.data(), (streamsize)bytes.size()); }
+        cerr.setstate(ios::failbit);   // silence the expected "[snapshot]" messages
+        Mapped_Arbor M;
+        bool ok = M.open(bad);
+        cerr.clear();
+        return ok;
+    };
+    auto patched = [&](auto&& edit) {
+        Snapshot_Header h;
+        memcpy(&h, image.data(), sizeof(h));
+        string bytes = image;
+        edit(h, bytes);
+        memcpy(&bytes[0], &h, sizeof(h));
+        return bytes;
+    };
+    CHECK(open_with(image));
+    CHECK(!open_with(image.substr(0, sizeof(Snapshot_Header) - 1)));
+    CHECK(!open_with(image.substr(0, image.size() - 8)));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.section[S_UP][0] = ~7ULL; h.section[S_UP][1] = 16; })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.n += 1; })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.n = 1ULL << 40; })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.edge_count -= 1; })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.log += 1; })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.universe *= 2; })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string&) { h.section[S_SLOTS][1] -= sizeof(Label_Interner::Slot); })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string& b) {   // no free slot: probes would never end
+        for (uint64_t i = 0; i < h.section[S_SLOTS][1]; i += sizeof(Label_Interner::Slot)) {
+            Label_Interner::Slot sl{0, 12345};
+            memcpy(&b[h.section[S_SLOTS][0] + i], &sl, sizeof(sl));
+        }
+    })));
+    CHECK(!open_with(patched([](Snapshot_Header& h, string& b) {
+        Label_Interner::Slot sl{(int32_t)h.n, 0};
+        memcpy(&b[h.section[S_SLOTS][0]], &sl, sizeof(sl));
+    })));
+    // Array contents: each edit stays inside its section but breaks something
+    // a query would index with.
+    Snapshot_Header h0;
+    memcpy(&h0, image.data(), sizeof(h0));
+    auto poked = [&](int sec, size_t i, auto value) {
+        string bytes = image;
+        memcpy(&bytes[h0.section[sec][0] + i * sizeof(value)], &value, sizeof(value));
+        return bytes;
+    };
+    auto at = [&](int sec, size_t i) {
+        int v;
+        memcpy(&v, &image[h0.section[sec][0] + i * sizeof(int)], sizeof(int));
+        return v;
+    };
+    int n = (int)h0.n, child = -1;
+    for (int v = 0; v < n && child == -1; ++v) if (at(S_PARENT, v) != -1) child = v;
+    CHECK(h0.tree_ready && child != -1);
+    CHECK(!open_with(poked(S_LABEL_OFFS, 1, h0.section[S_ARENA][1] + 1)));    // past the arena
+    CHECK(!open_with(poked(S_LABEL_OFFS, 2, (uint64_t)0)));                   // decreasing
+    CHECK(!open_with(poked(S_CSR_OFFS, 1, at(S_CSR_OFFS, 2) + 1)));
+    CHECK(!open_with(poked(S_CSR_NBRS, 0, n)));
+    CHECK(!open_with(poked(S_CSR_NBRS, 1, -1)));
+    CHECK(!open_with(poked(S_CHILD_END, 0, at(S_CSR_OFFS, 1) + 1)));
+    CHECK(!open_with(poked(S_CHILD_BEGIN, 0, at(S_CHILD_END, 0) + 1)));
+    CHECK(!open_with(poked(S_PARENT, child, n)));
+    CHECK(!open_with(poked(S_PARENT, child, child)));                          // a parent loop
+    CHECK(!open_with(poked(S_DEPTH, child, at(S_DEPTH, child) + 1)));
+    CHECK(!open_with(poked(S_UP, (size_t)child * h0.log, at(S_PARENT, child) == 0 ? 1 : 0)));
+    if (h0.log > 1) CHECK(!open_with(poked(S_UP, (size_t)child * h0.log + 1, n)));
+    remove(file.c_str());
+    remove(bad.c_str());
+}
+
+// An edge file of disjoint pairs (two new labels per edge) outgrows the
+// edges + 1 reserve and loads all the same.
+static void test_load_edges_disjoint() {
+    string file = "tests_tmp.edges";
+    {
+        ofstream out(file);
+        for (int i = 0; i < 1000; ++i) out << "p" << i << "\tc" << i << "\n";
+    }
+    Arbor A(1, true);
+    CHECK_EQ(load_edges_file(A, file, 2), 1000LL);
+    CHECK_EQ(A.size(), 2000);
+    CHECK_EQ(A.U, 2048);
+    // Grown from the edges + 1 reserve, not sized for two labels per edge.
+    CHECK(A.adj.capacity() >= (size_t)2000 && A.adj.capacity() < (size_t)4000);
+    CHECK_EQ(A.labels.slots.size(), (size_t)4096);
+    for (int i = 0; i < 1000; i += 97) CHECK_EQ(A.distance("p" + to_string(i), "c" + to_string(i)), 1);
+    remove(file.c_str());
+}
+
+// Shared labels across chunks and both separators: every label gets the ID a
+// connect_parent_child build of the same edges gives it, and the ID index is
+// sized for the labels actually added, not for two per edge.
+static void test_load_edges_ids() {
+    string file = "tests_tmp.edges";
+    vector<pair<string,string>> edges{{"a", "b"}, {"b", "c"}};
+    mt19937 rng(8);
+    for (int i = 0; i < 12000; ++i) edges.push_back({"x" + to_string(rng() % 5000), "x" + to_string(rng() % 5000)});
+    {
+        ofstream out(file);
+        for (size_t i = 0; i < edges.size(); ++i) out << edges[i].first << (i % 3 ? "\t" : ",") << edges[i].second << "\n";
+    }
+    Arbor A, ref;
+    for (auto& e : edges) ref.connect_parent_child(e.first, e.second);
+    CHECK_EQ(load_edges_file(A, file, 4), (long long)edges.size());
+    CHECK_EQ(A.id_of("a"), 0);
+    CHECK_EQ(A.id_of("b"), 1);
+    CHECK_EQ(A.id_of("c"), 2);
+    CHECK_EQ(A.size(), ref.size());
+    for (int v = 0; v < min(A.size(), ref.size()); ++v) {
+        CHECK_EQ(A.label_of(v), ref.label_of(v));
+        CHECK(A.adj[v] == ref.adj[v]);
+        CHECK_EQ(A.parent_of[v], ref.parent_of[v]);
+    }
+    CHECK_EQ(A.U, ref.U);
+    vector<int> keys;
+    A.veb->enumerate(keys);
+    CHECK_EQ((int)keys.size(), A.size());
+    CHECK_EQ(A.veb->max(), A.size() - 1);
+    remove(file.c_str());
+}
+
+// All-pairs matrix file: LCA tiles (odd tile sizes included) and per-row BFS
+// give the same BFS distances; a non-positive tile or an unwritable path is
+// rejected.
+static void test_distance_matrix() {
+    string file = "tests_tmp.apd";
+    Arbor A = random_forest(150, 9, 6);
+    A.freeze();
+    vector<vector<int>> want;
+    for (int s = 0; s < A.size(); ++s) want.push_back(bfs_reference(A, s));
+    for (auto [tile, bfs] : vector<pair<int,bool>>{{256, false}, {7, false}, {1, false}, {256, true}}) {
+        CHECK(write_distance_matrix(A, file, 2, tile, bfs));
+        Mapped_File m;
+        CHECK(m.open(file));
+        const int32_t* d = (const int32_t*)(m.data + sizeof(Distance_Matrix_Header));
+        CHECK_EQ(m.size, sizeof(Distance_Matrix_Header) + want.size() * want.size() * sizeof(int32_t));
+        for (size_t i = 0; i < want.size(); ++i)
+            for (size_t j = 0; j < want.size(); ++j) CHECK_EQ(d[i * want.size() + j], want[i][j]);
+    }
+    CHECK(A.tree_ready);
+    cerr.setstate(ios::failbit);
+    CHECK(!write_distance_matrix(A, file, 2, 0));
+    CHECK(!write_distance_matrix(A, file, 2, -5));
+    CHECK(!write_distance_matrix(A, "no_such_dir/" + file, 2));
+    cerr.clear();
+    remove(file.c_str());
+}
+
+// -------------------------------- Builders -----------------------------------
+// build_synthetic_porhyry against the string-based generator it replaced, on
+// an empty Arbor (IDs assigned arithmetically) and on non-empty ones (the
+// ensure_node path), plus a small tree written out by hand.
+static void build_synthetic_reference(Arbor& A, int levels, int B) {
+    if (levels <= 0) return;
+    vector<string> prev{"L1_0"};
+    A.ensure_node("L1_0");
+    for (int lvl = 2; lvl <= levels; ++lvl) {
+        vector<string> cur;
+        for (const string& p : prev) {
+            for (int b = 0; b < B; ++b) {
+                string name = "L" + to_string(lvl) + "_" + to_string(cur.size());
+                A.connect_parent_child(p, name);
+                cur.push_back(name);
+            }
+        }
+        prev.swap(cur);
+    }
+}
+
+static void check_same_arbor(const Arbor& A, const Arbor& B) {
+    CHECK_EQ(A.size(), B.size());
+    CHECK_EQ(A.edge_count, B.edge_count);
+    for (int v = 0; v < min(A.size(), B.size()); ++v) {
+        CHECK_EQ(A.label_of(v), B.label_of(v));
+        CHECK(A.adj[v] == B.adj[v]);
+        CHECK_EQ(A.parent_of[v], B.parent_of[v]);
+        CHECK(A.veb->contains(v));
+    }
+}
+
+static void test_synthetic_builder() {
+    for (auto [levels, B] : vector<pair<int,int>>{{1, 3}, {3, 2}, {4, 3}, {6, 1}, {3, 0}, {2, -2}, {0, 3}}) {
+        Arbor fresh, ref;
+        build_synthetic_porhyry(fresh, levels, B);
+        build_synthetic_reference(ref, levels, B);
+        check_same_arbor(fresh, ref);
+        for (const char* pre : {"L1_0", "x"}) {      // the root already there / an unrelated node
+            Arbor seeded, seeded_ref;
+            seeded.ensure_node(pre);
+            seeded_ref.ensure_node(pre);
+            build_synthetic_porhyry(seeded, levels, B);
+            build_synthetic_reference(seeded_ref, levels, B);
+            check_same_arbor(seeded, seeded_ref);
+        }
+    }
+    Arbor A;
+    build_synthetic_porhyry(A, 3, 2);
+    const char* labels[] = {"L1_0", "L2_0", "L2_1", "L3_0", "L3_1", "L3_2", "L3_3"};
+    const int parents[] = {-1, 0, 0, 1, 1, 2, 2};
+    CHECK_EQ(A.size(), 7);
+    for (int v = 0; v < min(A.size(), 7); ++v) {
+        CHECK_EQ(A.label_of(v), string_view(labels[v]));
+        CHECK_EQ(A.parent_of[v], parents[v]);
+    }
+    Arbor root_only;
+    build_synthetic_porhyry(root_only, 4, 0);
+    CHECK_EQ(root_only.size(), 1);
+    CHECK_EQ(root_only.id_of("L1_0"), 0);
+}
+
+// -------------------------------- Diagrams -----------------------------------
+// The ASCII printer shows the root's parent_of subtree, frozen or not: no
+// walk back up through the root's ancestors, no cross-links, no duplicates.
+static void test_ascii_tree() {
+    auto print = [](const Arbor& A, const char* root, int max_depth = -1, size_t max_nodes = 0) {
+        stringstream ss;
+        print_ascii_tree_from_root(A, root, max_depth, max_nodes, ss);
+        return ss.str();
+    };
+    const string vivo =
+        "Vivo\n"
+        "+-Profesor\n"
+        "| +-Catedra\n"
+        "| +-Tiempo_completo\n"
+        "+-Estudiante\n"
+        "  +-Licenciatura\n"
+        "  | +-Negocios\n"
+        "  |   +-Jefe\n"
+        "  +-Ingenieria\n"
+        "    +-ITC\n"
+        "    | +-Desvelado\n"
+        "    | +-No_Desvelado\n"
+        "    +-IRS\n"
+        "    +-ITD\n";
+    for (bool cross : {false, true}) {
+        Arbor A;
+        build_sample_students(A);
+        if (cross) {
+            A.connect_parent_child("Gato", "Profesor");          // a second parent
+            A.connect_parent_child("Vivo", "Profesor");          // a duplicate edge
+            A.connect_parent_child("Humano", "Ser_viviente");    // a parent 2-cycle
+        }
+        const string top = cross ? "Ser_viviente\n+-Animal\n  +-Perro\n  +-Gato\n"
+                                 : "Ser_viviente\n+-Humano\n| +-Muerto\n| | +-En_paz\n";
+        string unfrozen = print(A, "Vivo");
+        CHECK_EQ(unfrozen, vivo);
+        CHECK_EQ(print(A, "Vivo", 1), string("Vivo\n+-Profesor [+2]\n+-Estudiante [+2]\n"));
+        CHECK_EQ(print(A, "Vivo", 0), string("Vivo [+2]\n"));
+        CHECK_EQ(print(A, "Vivo", -1, 3), string("Vivo\n+-Profesor\n| +-Catedra\n... (truncated after 3 nodes)\n"));
+        CHECK_EQ(print(A, "Profesor", -1, 3), string("Profesor\n+-Catedra\n+-Tiempo_completo\n"));
+        CHECK_EQ(print(A, "Profesor", -1, 2), string("Profesor\n+-Catedra\n... (truncated after 2 nodes)\n"));
+        CHECK_EQ(print(A, "Jefe"), string("Jefe\n"));
+        CHECK_EQ(print(A, "Ser_viviente").substr(0, top.size()), top);
+        A.freeze();
+        CHECK_EQ(print(A, "Vivo"), unfrozen);
+        CHECK_EQ(print(A, "Vivo", 1), string("Vivo\n+-Profesor [+2]\n+-Estudiante [+2]\n"));
+        CHECK_EQ(print(A, "Vivo", -1, 3), string("Vivo\n+-Profesor\n| +-Catedra\n... (truncated after 3 nodes)\n"));
+        CHECK_EQ(print(A, "Profesor", -1, 3), string("Profesor\n+-Catedra\n+-Tiempo_completo\n"));
+        CHECK_EQ(print(A, "Ser_viviente").substr(0, top.size()), top);
+    }
+    // A whole tree of exactly max_nodes nodes is not truncated.
+    Arbor R;
+    R.connect_parent_child("r", "a");
+    R.connect_parent_child("r", "b");
+    CHECK_EQ(print(R, "r", -1, 3), string("r\n+-a\n+-b\n"));
+    CHECK_EQ(print(R, "r", -1, 2), string("r\n+-a\n... (truncated after 2 nodes)\n"));
+}
+
+// emit_graphviz depth limit and sharding on a small tree, with quotes and
+// backslashes in a label.
+static void test_graphviz() {
+    Arbor A;
+    A.connect_parent_child("r", "a");
+    A.connect_parent_child("r", "b\"q\\");
+    A.connect_parent_child("a", "a1");
+    A.connect_parent_child("a1", "a2");
+    A.connect_parent_child("b\"q\\", "b1");
+    A.freeze();
+    const string base = "tests_tmp_graph";
+    auto node = [&](int v, const char* label) { return "  n" + to_string(v) + " [label=\"" + label + "\"];\n"; };
+    auto edge = [](int p, int c) { return "  n" + to_string(p) + " -- n" + to_string(c) + ";\n"; };
+    const string head = "graph Porphyry {\n  rankdir=TB;\n  node [shape=box, style=rounded];\n";
+    int r = A.id_of("r"), a = A.id_of("a"), b = A.id_of("b\"q\\"), a1 = A.id_of("a1"), a2 = A.id_of("a2"), b1 = A.id_of("b1");
+    const string top = head + node(r, "r") + node(a, "a") + node(b, "b\\\"q\\\\") + edge(r, a) + edge(r, b) + "}\n";
+
+    cerr.setstate(ios::failbit);   // silence the "[graphviz] wrote" lines
+    Graphviz_Options depth1;
+    depth1.max_depth = 1;
+    vector<string> files = emit_graphviz(A, base + ".dot", depth1);
+    CHECK(files == vector<string>{base + ".dot"});
+    CHECK_EQ(read_file(base + ".dot"), top);
+
+    Graphviz_Options both;
+    both.shard_depth = 1;
+    both.max_depth = 1;                        // shards start below the limit: none
+    files = emit_graphviz(A, base + ".dot", both);
+    CHECK(files == vector<string>{base + ".dot"});
+    CHECK_EQ(read_file(base + ".dot"), top);
+
+    Graphviz_Options shards;
+    shards.shard_depth = 1;
+    shards.max_depth = 2;
+    string shard_a = base + "_" + to_string(a) + ".dot", shard_b = base + "_" + to_string(b) + ".dot";
+    files = emit_graphviz(A, base + ".dot", shards);
+    CHECK((files == vector<string>{base + ".dot", shard_a, shard_b}));
+    CHECK_EQ(read_file(base + ".dot"), top);
+    CHECK_EQ(read_file(shard_a), head + node(a, "a") + node(a1, "a1") + edge(a, a1) + "}\n");
+    CHECK_EQ(read_file(shard_b), head + node(b, "b\\\"q\\\\") + node(b1, "b1") + edge(b, b1) + "}\n");
+
+    shards.max_depth = -1;
+    files = emit_graphviz(A, base + ".dot", shards);
+    CHECK_EQ(files.size(), (size_t)3);
+    CHECK_EQ(read_file(shard_a), head + node(a, "a") + node(a1, "a1") + node(a2, "a2") + edge(a, a1) + edge(a1, a2) + "}\n");
+    cerr.clear();
+    for (const string& f : {base + ".dot", shard_a, shard_b}) remove(f.c_str());
+}
+
+// ------------------------------- Instrumentation -----------------------------
+// Under -DARBOR_STATS each shortest_path / distance call counts one path query;
+// without it dump_stats() says the counters are disabled.
+static void test_stats() {
+    Arbor A = random_forest(100, 10, 3);
+#ifdef ARBOR_STATS
+    reset_stats();
+    for (int i = 0; i < 10; ++i) A.distance("n0", id_label(i));
+    for (int i = 0; i < 5; ++i) A.shortest_path("n0", id_label(i));
+    CHECK_EQ(arbor_stats().path_queries.load(), (uint64_t)15);
+    CHECK(arbor_stats().path_nodes_settled.load() > 0);
+    A.freeze();
+    CHECK_EQ(arbor_stats().freeze_calls.load(), (uint64_t)1);
+    reset_stats();
+    CHECK_EQ(arbor_stats().path_queries.load(), (uint64_t)0);
+#else
+    stringstream ss;
+    dump_stats(ss, true);
+    CHECK_EQ(ss.str(), string("{\"enabled\": false}\n"));
+#endif
+}
+
+// memory_usage() grows by the CSR and tree index after freeze(); the intervals
+// are sized with the ID space from the start (placeholders until built).
+static void test_memory_usage() {
+    Arbor A = random_forest(500, 20, 2);
+    auto part = [](const Memory_Report& r, const string& name) {
+        for (auto& p : r.parts) if (p.name == name) return p.bytes;
+        return (size_t)0;
+    };
+    Memory_Report before = A.memory_usage();
+    CHECK(before.total_bytes() > 0);
+    CHECK(part(before, "adj") > 0 && part(before, "index:veb") > 0);
+    CHECK_EQ(part(before, "csr"), (size_t)0);
+    CHECK(part(before, "intervals") >= 2 * (size_t)A.size() * sizeof(int));
+    CHECK(A.freeze());
+    Memory_Report frozen = A.memory_usage();
+    CHECK(frozen.total_bytes() > before.total_bytes());
+    CHECK(part(frozen, "csr") >= (size_t)A.size() * sizeof(int));
+    CHECK(part(frozen, "tree_index") >= (size_t)A.size() * sizeof(int));
+    CHECK(A.build_intervals());
+    Memory_Report intervals = A.memory_usage();
+    CHECK_EQ(intervals.total_bytes(), frozen.total_bytes());
+    CHECK(part(intervals, "intervals") >= 2 * (size_t)A.size() * sizeof(int));
+    CHECK(!intervals.veb_levels.empty());
+}
+
+// ------------------------------ Memory resources -----------------------------
+// An Arbor built in a monotonic arena answers like one on the default heap,
+// and a copy of it outlives the arena.
+static void test_arena_arbor() {
+    for (auto& kv : INDEX_KINDS) {
+        Arbor ref = random_forest(300, 15, 9, kv.second);
+        Arbor copy;
+        {
+            pmr::monotonic_buffer_resource arena;
+            Arbor A = random_forest(300, 15, 9, kv.second, &arena);
+            CHECK(A.resource() == &arena);
+            A.freeze();
+            ref.freeze();
+            for (int t = 0; t < A.size(); t += 7) CHECK_EQ(A.tree_distance(0, t), ref.tree_distance(0, t));
+            copy = A;
+        }
+        CHECK(copy.resource() == pmr::get_default_resource());
+        for (int v = 0; v < copy.size(); ++v) CHECK(copy.veb->contains(v));
+        CHECK_EQ(copy.distance("n0", "n299"), ref.distance("n0", "n299"));
+    }
+}
+
+// Upstream for an arena that overwrites freed blocks instead of returning them,
+// so anything still pointing into a released arena reads garbage
+// deterministically (and without undefined behaviour).
+class Scribble_Resource : public pmr::memory_resource {
+public:
+    ~Scribble_Resource() override { for (auto& b : blocks) ::operator delete(b.first, align_val_t(b.second)); }
+
+private:
+    vector<pair<void*, size_t>> blocks;   // (block, alignment), kept until destruction
+
+    void* do_allocate(size_t bytes, size_t align) override {
+        void* p = ::operator new(bytes, align_val_t(align));
+        blocks.push_back({p, align});
+        return p;
+    }
+    void do_deallocate(void* p, size_t bytes, size_t) override { memset(p, 0xA5, bytes); }
+    bool do_is_equal(const pmr::memory_resource& o) const noexcept override { return this == &o; }
+};
+
+// Move- and copy-assignment between Arbors on different resources: the target
+// keeps its own resource for everything, the ID index included.
+static void test_arena_assignment() {
+    for (auto& kv : INDEX_KINDS) {
+        Scribble_Resource upstream;
+        Arbor A(16, true, kv.second), C(16, true, kv.second);
+        pmr::monotonic_buffer_resource target_arena;
+        Arbor T(16, true, kv.second, &target_arena);
+        {
+            pmr::monotonic_buffer_resource arena(&upstream);
+            Arbor B = random_forest(200, 15, 4, kv.second, &arena);
+            B.freeze();
+            Arbor B2 = B;                 // default resource
+            C = B;                        // copy-assign: C keeps the default resource
+            T = std::move(B2);            // different resources: T clones into its arena
+            A = std::move(B);
+        }                                 // B's arena is released and scribbled here
+        for (Arbor* X : {&A, &C, &T}) {
+            CHECK_EQ(X->size(), 200);
+            vector<int> keys;
+            X->veb->enumerate(keys);
+            CHECK_EQ(keys.size(), (size_t)200);
+            for (int v = 0; v < X->size(); ++v) CHECK(X->veb->contains(v));
+            CHECK_EQ(X->id_of("n150"), 150);
+            CHECK_EQ(X->distance("n0", "n199"), random_forest(200, 15, 4).distance("n0", "n199"));
+        }
+        CHECK(A.resource() == pmr::get_default_resource());
+        CHECK(T.resource() == &target_arena);
+    }
+}
+
+// -------------------------------- Driver -------------------------------------
+int main(int argc, char** argv){
+    string filter;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--filter" && i + 1 < argc) filter = argv[++i];
+        else { cerr << "unknown option: " << a << "\n"; return 2; }
+    }
+    const pair<const char*, void (*)()> tests[] = {
+        {"index/ordered_set", test_index_ordered_set},
+        {"index/bulk", test_index_bulk},
+        {"index/ranges", test_index_ranges},
+        {"index/key_iterators", test_veb_iterators},
+        {"index/static", test_static_veb},
+        {"index/static_fallback", test_static_fallback},
+        {"arbor/label_interner", test_label_interner},
+        {"arbor/freeze_csr", test_freeze_csr},
+        {"arbor/tree_index", test_tree_index},
+        {"arbor/incremental_lca", test_incremental_lca},
+        {"arbor/incremental_intervals", test_incremental_intervals},
+        {"arbor/renumber_preorder", test_renumber_preorder},
+        {"paths/bidirectional_bfs", test_bidirectional_bfs},
+        {"paths/weighted_dijkstra", test_weighted_dijkstra},
+        {"paths/cache", test_path_cache},
+        {"paths/cache_erase", test_path_cache_erase},
+        {"concurrent/snapshots", test_concurrent_arbor},
+        {"simd/match_ranges", test_match_ranges},
+        {"snapshot/roundtrip", test_snapshot_roundtrip},
+        {"snapshot/corrupt", test_snapshot_corrupt},
+        {"loader/disjoint_pairs", test_load_edges_disjoint},
+        {"loader/ids", test_load_edges_ids},
+        {"paths/distance_matrix", test_distance_matrix},
+        {"builders/synthetic", test_synthetic_builder},
+        {"diagrams/ascii_tree", test_ascii_tree},
+        {"diagrams/graphviz", test_graphviz},
+        {"stats/counters", test_stats},
+        {"memory/usage", test_memory_usage},
+        {"memory/arena", test_arena_arbor},
+        {"memory/arena_assignment", test_arena_assignment},
+    };
+    int run = 0;
+    for (auto& [name, fn] : tests) {
+        if (!filter.empty() && string(name).find(filter) == string::npos) continue;
+        int before = g_failures;
+        fn();
+        ++run;
+        cout << (g_failures == before ? "[ ok ] " : "[FAIL] ") << name << "\n";
+    }
+    cout << run << " test(s), " << g_failures << " failed check(s)\n";
+    return g_failures ? 1 : 0;
+}